@@ -0,0 +1,64 @@
+#ifndef BYTEIO_H
+#define BYTEIO_H
+
+#include <cerrno>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+
+// Byte-level helpers shared by the checkpoint, trace and wave stream code:
+// LEB128 varints and writing a whole buffer to a file descriptor.
+class ByteIo {
+public:
+    // Seven bits per byte, low bits first; the high bit marks that more
+    // bytes follow.
+    static void putVarint(std::string &out, uint64_t v) {
+        while (v >= 0x80) {
+            out.push_back(static_cast<char>((v & 0x7f) | 0x80));
+            v >>= 7;
+        }
+        out.push_back(static_cast<char>(v));
+    }
+
+    // False if `in` ends inside the varint.
+    static bool getVarint(std::string_view &in, uint64_t &v) {
+        v = 0;
+        for (unsigned shift = 0; shift < 64 && !in.empty(); shift += 7) {
+            uint8_t byte = static_cast<uint8_t>(in.front());
+            in.remove_prefix(1);
+            v |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) return true;
+        }
+        return false;
+    }
+
+    // Retries short writes and EINTR. False on any other error, with errno
+    // left set.
+    static bool writeAll(int fd, const char *p, size_t n) {
+        while (n > 0) {
+            ssize_t w = ::write(fd, p, n);
+            if (w < 0) {
+                if (errno == EINTR) continue;
+                return false;
+            }
+            p += w;
+            n -= static_cast<size_t>(w);
+        }
+        return true;
+    }
+
+    // Prints `what`, the path and errno's message, and exits with 1.
+    [[noreturn]] static void ioError(const char *what,
+                                     const std::string &path) {
+        std::cerr << what << " " << path << ": " << std::strerror(errno)
+                  << "\n";
+        std::exit(1);
+    }
+};
+
+#endif
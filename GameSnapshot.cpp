@@ -0,0 +1,93 @@
+// GameSnapshot.cpp   Checkpoint file encoding and validation.
+
+#include <cerrno>
+#include <cstdio>
+#include <cstdlib>
+#include <iostream>
+#include <fcntl.h>
+#include <unistd.h>
+#include "ByteIo.h"
+#include "GameSnapshot.h"
+
+namespace {
+
+const char MAGIC[] = "KCKP";
+const size_t MAGIC_SIZE = 4;
+const uint8_t VERSION = 2;
+
+}
+
+uint64_t snapshotHash(const char *begin, const char *end) {
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (const char *p = begin; p != end; p++) {
+        h ^= static_cast<uint8_t>(*p);
+        h *= 0x100000001b3ULL;
+    }
+    return h;
+}
+
+void SnapshotWriter::writeFile(const std::string &path) const {
+    std::string file(MAGIC, MAGIC_SIZE);
+    file.push_back(static_cast<char>(VERSION));
+    file += buf_;
+    uint64_t sum = snapshotHash(buf_.data(), buf_.data() + buf_.size());
+    for (int i = 0; i < 8; i++) {
+        file.push_back(static_cast<char>(sum >> (8 * i)));
+    }
+
+    std::string tmp = path + ".tmp";
+    int fd = open(tmp.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+    if (fd < 0) ByteIo::ioError("Cannot write checkpoint", tmp);
+    if (!ByteIo::writeAll(fd, file.data(), file.size()) || close(fd) != 0) {
+        ByteIo::ioError("Cannot write checkpoint", tmp);
+    }
+    if (std::rename(tmp.c_str(), path.c_str()) != 0) {
+        ByteIo::ioError("Cannot write checkpoint", path);
+    }
+}
+
+SnapshotReader::SnapshotReader(const std::string &path) : path_(path) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if (fd < 0) ByteIo::ioError("Cannot open checkpoint", path);
+    char block[1 << 16];
+    while (true) {
+        ssize_t got = read(fd, block, sizeof(block));
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) ByteIo::ioError("Cannot read checkpoint", path);
+        if (got == 0) break;
+        data_.append(block, static_cast<size_t>(got));
+    }
+    close(fd);
+
+    if (data_.size() < MAGIC_SIZE + 1 + 8 ||
+        data_.compare(0, MAGIC_SIZE, MAGIC) != 0 ||
+        static_cast<uint8_t>(data_[MAGIC_SIZE]) != VERSION) {
+        fail();
+    }
+    const char *begin = data_.data() + MAGIC_SIZE + 1;
+    const char *end = data_.data() + data_.size() - 8;
+    uint64_t sum = 0;
+    for (int i = 0; i < 8; i++) {
+        sum |= static_cast<uint64_t>(static_cast<uint8_t>(end[i])) << (8 * i);
+    }
+    if (sum != snapshotHash(begin, end)) fail();
+    rest_ = std::string_view(begin, static_cast<size_t>(end - begin));
+}
+
+uint64_t SnapshotReader::get() {
+    uint64_t v;
+    if (!ByteIo::getVarint(rest_, v)) fail();
+    return v;
+}
+
+std::string SnapshotReader::getString() {
+    size_t n = getCount();
+    std::string s(rest_.substr(0, n));
+    rest_.remove_prefix(n);
+    return s;
+}
+
+void SnapshotReader::fail() const {
+    std::cerr << "Invalid or corrupt checkpoint: " << path_ << "\n";
+    std::exit(1);
+}
@@ -0,0 +1,75 @@
+#ifndef GAMESNAPSHOT_H
+#define GAMESNAPSHOT_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "ByteIo.h"
+
+// Checkpoint files written by `game --checkpoint-every N` and read back by
+// `game --resume FILE`:
+//
+//   file := "KCKP" version:u8 payload checksum:u64le
+//
+// The payload is a sequence of varints and length-prefixed strings whose
+// layout is defined by MarioCastleDefense::saveState; the checksum is
+// FNV-1a over the payload, so a torn or truncated file is rejected.
+class SnapshotWriter {
+public:
+    void put(uint64_t v) {
+        ByteIo::putVarint(buf_, v);
+    }
+
+    void putString(std::string_view s) {
+        put(s.size());
+        buf_.append(s.data(), s.size());
+    }
+
+    // Writes the file to `path` through a temporary and a rename, so an
+    // existing checkpoint is only replaced by a complete one.
+    void writeFile(const std::string &path) const;
+
+private:
+    std::string buf_;
+};
+
+// Decodes a snapshot. Any malformed or truncated field is fatal.
+class SnapshotReader {
+public:
+    // Reads and verifies the file; exits with a message if it is unusable.
+    explicit SnapshotReader(const std::string &path);
+
+    uint64_t get();
+
+    uint32_t get32() {
+        uint64_t v = get();
+        if (v > UINT32_MAX) fail();
+        return static_cast<uint32_t>(v);
+    }
+
+    std::string getString();
+
+    // Reads a count of items that each take at least one byte, so a
+    // corrupt count cannot trigger a huge allocation.
+    size_t getCount() {
+        uint64_t n = get();
+        if (n > rest_.size()) fail();
+        return static_cast<size_t>(n);
+    }
+
+    bool atEnd() const { return rest_.empty(); }
+
+    [[noreturn]] void fail() const;
+
+private:
+    std::string path_;
+    std::string data_;
+    std::string_view rest_;
+};
+
+// FNV-1a, used for the payload checksum and the scenario fingerprint.
+uint64_t snapshotHash(const char *begin, const char *end);
+
+#endif
@@ -0,0 +1,146 @@
+#ifndef INDEXEDHEAP_H
+#define INDEXEDHEAP_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include <limits>
+
+// D-ary heap over small integer handles with a position index, so any
+// handle can be re-keyed or removed in place instead of being pushed again
+// or left behind as a stale entry. Before(a, b) is true when handle a must
+// come out before handle b; top() is the handle that comes out first.
+template <typename Before, unsigned D = 4>
+class IndexedHeap {
+public:
+    static constexpr uint32_t NPOS = std::numeric_limits<uint32_t>::max();
+
+    explicit IndexedHeap(Before b) : before(b) {}
+
+    bool empty() const { return heap.empty(); }
+    size_t size() const { return heap.size(); }
+    uint32_t top() const { return heap.front(); }
+
+    void push(uint32_t h) {
+        if (pos.size() <= h) pos.resize(static_cast<size_t>(h) + 1, NPOS);
+        heap.push_back(h);
+        siftUp(heap.size() - 1);
+    }
+
+    // Adds n handles at once. A batch at least half the heap's size is
+    // appended and the whole array rebuilt bottom-up, O(size) in total
+    // instead of O(n log size); a smaller one is pushed one by one.
+    void pushAll(const uint32_t *handles, size_t n) {
+        if (2 * n < heap.size()) {
+            for (size_t i = 0; i < n; i++) push(handles[i]);
+            return;
+        }
+        heap.reserve(heap.size() + n);
+        for (size_t i = 0; i < n; i++) {
+            uint32_t h = handles[i];
+            if (pos.size() <= h) pos.resize(static_cast<size_t>(h) + 1, NPOS);
+            pos[h] = static_cast<uint32_t>(heap.size());
+            heap.push_back(h);
+        }
+        if (heap.size() < 2) return;
+        for (size_t i = (heap.size() - 2) / D + 1; i-- > 0;) siftDown(i);
+    }
+
+    void pop() {
+        erase(heap.front());
+    }
+
+    void erase(uint32_t h) {
+        size_t i = pos[h];
+        pos[h] = NPOS;
+        uint32_t last = heap.back();
+        heap.pop_back();
+        if (last == h) return;
+        heap[i] = last;
+        pos[last] = static_cast<uint32_t>(i);
+        if (i > 0 && before(last, heap[(i - 1) / D])) {
+            siftUp(i);
+        } else {
+            siftDown(i);
+        }
+    }
+
+    // h's key moved towards the front (e.g. its health dropped).
+    void decreaseKey(uint32_t h) {
+        siftUp(pos[h]);
+    }
+
+    // The object behind handle `from` is now addressed as `to`, as when a
+    // swap-remove moves the last slot of a dense array. `to` must not be
+    // in the heap.
+    void rename(uint32_t from, uint32_t to) {
+        if (pos.size() <= to) pos.resize(static_cast<size_t>(to) + 1, NPOS);
+        pos[to] = from < pos.size() ? pos[from] : NPOS;
+        if (pos[to] != NPOS) {
+            heap[pos[to]] = to;
+            pos[from] = NPOS;
+        }
+    }
+
+    // Raw heap array, root first.
+    const std::vector<uint32_t> &items() const { return heap; }
+
+    // Replaces the contents with a heap array saved from items(). Returns
+    // false if it repeats a handle or breaks the heap order.
+    bool restore(const std::vector<uint32_t> &items) {
+        heap = items;
+        pos.clear();
+        for (size_t i = 0; i < heap.size(); i++) {
+            uint32_t h = heap[i];
+            if (pos.size() <= h) pos.resize(static_cast<size_t>(h) + 1, NPOS);
+            if (pos[h] != NPOS ||
+                (i > 0 && before(h, heap[(i - 1) / D]))) {
+                heap.clear();
+                pos.clear();
+                return false;
+            }
+            pos[h] = static_cast<uint32_t>(i);
+        }
+        return true;
+    }
+
+private:
+    Before before;
+    std::vector<uint32_t> heap;
+    std::vector<uint32_t> pos;
+
+    void siftUp(size_t i) {
+        uint32_t h = heap[i];
+        while (i > 0) {
+            size_t parent = (i - 1) / D;
+            if (!before(h, heap[parent])) break;
+            heap[i] = heap[parent];
+            pos[heap[i]] = static_cast<uint32_t>(i);
+            i = parent;
+        }
+        heap[i] = h;
+        pos[h] = static_cast<uint32_t>(i);
+    }
+
+    void siftDown(size_t i) {
+        uint32_t h = heap[i];
+        size_t n = heap.size();
+        while (true) {
+            size_t first = i * D + 1;
+            if (first >= n) break;
+            size_t end = first + D < n ? first + D : n;
+            size_t best = first;
+            for (size_t c = first + 1; c < end; c++) {
+                if (before(heap[c], heap[best])) best = c;
+            }
+            if (!before(heap[best], h)) break;
+            heap[i] = heap[best];
+            pos[heap[i]] = static_cast<uint32_t>(i);
+            i = best;
+        }
+        heap[i] = h;
+        pos[h] = static_cast<uint32_t>(i);
+    }
+};
+
+#endif
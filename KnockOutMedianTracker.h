@@ -0,0 +1,102 @@
+#ifndef KNOCKOUTMEDIANTRACKER_H
+#define KNOCKOUTMEDIANTRACKER_H
+
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+// Order statistics over knock-out lifetimes. A lifetime never exceeds the
+// current round, so the values are counted in a Fenwick tree indexed by
+// lifetime: add() and every quantile query cost O(log R) and memory grows
+// with the number of rounds played, not with the number of knock-outs.
+class KnockOutMedianTracker {
+private:
+    std::vector<uint64_t> tree;   // 1-based, capacity is a power of two
+    uint64_t total = 0;
+
+    size_t capacity() const {
+        return tree.empty() ? 0 : tree.size() - 1;
+    }
+
+    // With a power-of-two capacity C, node i <= C covers (i - lowbit(i), i].
+    // Doubling C leaves those ranges alone; of the new nodes only the powers
+    // of two cover old values, and each covers all of them.
+    void grow(uint32_t val) {
+        size_t cap = capacity();
+        size_t newCap = cap == 0 ? 64 : cap;
+        while (newCap < val) newCap *= 2;
+        if (newCap == cap) return;
+        uint64_t carried = cap == 0 ? 0 : tree[cap];
+        tree.resize(newCap + 1, 0);
+        for (size_t c = cap * 2; cap != 0 && c <= newCap; c *= 2) {
+            tree[c] = carried;
+        }
+    }
+
+public:
+    void add(uint32_t val) {
+        if (val > capacity()) grow(val);
+        size_t cap = capacity();
+        for (size_t i = val; i <= cap; i += i & (~i + 1)) {
+            tree[i]++;
+        }
+        total++;
+    }
+
+    bool empty() const {
+        return total == 0;
+    }
+
+    uint64_t size() const {
+        return total;
+    }
+
+    // Raw Fenwick nodes, for checkpoints.
+    const std::vector<uint64_t> &nodes() const {
+        return tree;
+    }
+
+    // Loads nodes saved from nodes(). Returns false unless the capacity is
+    // a power of two.
+    bool restore(const std::vector<uint64_t> &saved) {
+        size_t cap = saved.empty() ? 0 : saved.size() - 1;
+        if (!saved.empty() && (cap == 0 || (cap & (cap - 1)) != 0)) {
+            return false;
+        }
+        tree = saved;
+        total = cap == 0 ? 0 : tree[cap];
+        return true;
+    }
+
+    // k-th smallest lifetime, 1-based; requires 1 <= k <= size().
+    uint32_t kth(uint64_t k) const {
+        size_t cap = capacity();
+        size_t pos = 0;
+        for (size_t step = cap; step > 0; step >>= 1) {
+            if (pos + step <= cap && tree[pos + step] < k) {
+                pos += step;
+                k -= tree[pos];
+            }
+        }
+        return static_cast<uint32_t>(pos + 1);
+    }
+
+    uint32_t getMedian() const {
+        if (total == 0) return 0;
+        if (total % 2 == 1) return kth((total + 1) / 2);
+        uint64_t a = kth(total / 2);
+        uint64_t b = kth(total / 2 + 1);
+        return static_cast<uint32_t>((a + b) / 2ULL);
+    }
+
+    // Nearest-rank percentile. milli is the percentile times 1000, so
+    // p99.9 is 99900; it must lie in [0, 100000].
+    uint32_t getPercentile(uint32_t milli) const {
+        if (total == 0) return 0;
+        uint64_t rank = (static_cast<uint64_t>(milli) * total + 99999) / 100000;
+        if (rank == 0) rank = 1;
+        return kth(rank);
+    }
+};
+
+#endif
@@ -0,0 +1,125 @@
+// KoopaMoveKernel.cpp   Saturating Koopa movement with SSE2/AVX2 paths.
+
+#include "KoopaMoveKernel.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define KOOPA_MOVE_X86 1
+#endif
+
+size_t KoopaMoveKernel::advanceScalar(uint32_t *distance,
+                                      const uint32_t *speed,
+                                      size_t begin,
+                                      size_t n) {
+    size_t breacher = n;
+    for (size_t i = begin; i < n; i++) {
+        uint32_t d = distance[i];
+        uint32_t step = d < speed[i] ? d : speed[i];
+        distance[i] = d - step;
+        if (distance[i] == 0 && breacher == n) {
+            breacher = i;
+        }
+    }
+    return breacher;
+}
+
+#ifdef KOOPA_MOVE_X86
+
+static size_t advanceSse2(uint32_t *distance,
+                          const uint32_t *speed,
+                          size_t n) {
+    const __m128i zero = _mm_setzero_si128();
+    const __m128i sign = _mm_set1_epi32(static_cast<int>(0x80000000U));
+    size_t breacher = n;
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i d = _mm_loadu_si128(reinterpret_cast<const __m128i*>(distance + i));
+        __m128i s = _mm_loadu_si128(reinterpret_cast<const __m128i*>(speed + i));
+        // SSE2 has no unsigned 32-bit compare: bias both sides by 2^31.
+        __m128i overshoot = _mm_cmpgt_epi32(_mm_xor_si128(s, sign),
+                                            _mm_xor_si128(d, sign));
+        __m128i next = _mm_andnot_si128(overshoot, _mm_sub_epi32(d, s));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(distance + i), next);
+
+        if (breacher == n) {
+            __m128i hit = _mm_cmpeq_epi32(next, zero);
+            int mask = _mm_movemask_ps(_mm_castsi128_ps(hit));
+            if (mask != 0) {
+                breacher = i + static_cast<size_t>(__builtin_ctz(
+                                   static_cast<unsigned>(mask)));
+            }
+        }
+    }
+    size_t tail = KoopaMoveKernel::advanceScalar(distance, speed, i, n);
+    return breacher != n ? breacher : tail;
+}
+
+__attribute__((target("avx2")))
+static size_t advanceAvx2(uint32_t *distance,
+                          const uint32_t *speed,
+                          size_t n) {
+    const __m256i zero = _mm256_setzero_si256();
+    size_t breacher = n;
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i d = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(distance + i));
+        __m256i s = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(speed + i));
+        __m256i next = _mm256_sub_epi32(d, _mm256_min_epu32(d, s));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(distance + i), next);
+
+        if (breacher == n) {
+            __m256i hit = _mm256_cmpeq_epi32(next, zero);
+            int mask = _mm256_movemask_ps(_mm256_castsi256_ps(hit));
+            if (mask != 0) {
+                breacher = i + static_cast<size_t>(__builtin_ctz(
+                                   static_cast<unsigned>(mask)));
+            }
+        }
+    }
+    size_t tail = KoopaMoveKernel::advanceScalar(distance, speed, i, n);
+    return breacher != n ? breacher : tail;
+}
+
+#endif
+
+namespace {
+
+typedef size_t (*AdvanceFn)(uint32_t*, const uint32_t*, size_t);
+
+struct Dispatch {
+    AdvanceFn fn;
+    const char *name;
+};
+
+#ifndef KOOPA_MOVE_X86
+size_t advanceScalarAll(uint32_t *distance, const uint32_t *speed, size_t n) {
+    return KoopaMoveKernel::advanceScalar(distance, speed, 0, n);
+}
+#endif
+
+Dispatch pickPath() {
+#ifdef KOOPA_MOVE_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return { advanceAvx2, "avx2" };
+    return { advanceSse2, "sse2" };
+#else
+    return { advanceScalarAll, "scalar" };
+#endif
+}
+
+const Dispatch &dispatch() {
+    static const Dispatch chosen = pickPath();
+    return chosen;
+}
+
+}
+
+size_t KoopaMoveKernel::advance(uint32_t *distance,
+                                const uint32_t *speed,
+                                size_t n) {
+    return dispatch().fn(distance, speed, n);
+}
+
+const char *KoopaMoveKernel::pathName() {
+    return dispatch().name;
+}
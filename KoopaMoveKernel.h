@@ -0,0 +1,28 @@
+#ifndef KOOPAMOVEKERNEL_H
+#define KOOPAMOVEKERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Per-round movement over the dense active-Koopa columns. The SSE2 and
+// AVX2 paths are picked once at runtime; every path produces the same
+// distances and the same result as the scalar loop.
+class KoopaMoveKernel {
+public:
+    // distance[i] -= min(distance[i], speed[i]) for every i < n. Returns
+    // the lowest i whose distance is now 0, or n if no Koopa reached the
+    // castle.
+    static size_t advance(uint32_t *distance,
+                          const uint32_t *speed,
+                          size_t n);
+
+    // Name of the path advance() dispatches to ("avx2", "sse2", "scalar").
+    static const char *pathName();
+
+    static size_t advanceScalar(uint32_t *distance,
+                                const uint32_t *speed,
+                                size_t begin,
+                                size_t n);
+};
+
+#endif
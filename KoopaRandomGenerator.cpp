@@ -1,12 +1,35 @@
 // KoopaRandomGenerator.cpp   Mersenne Twister code by T. Nishimura & M. Matsumoto.
 
 
-#include <iostream>
+#include <algorithm>
+#include <charconv>
 #include "KoopaRandomGenerator.h"
+#include "MersenneTwistKernel.h"
+#include "MersenneTwistJump.h"
+#include "WorkStealingRange.h"
 
-KoopaRandomGenerator::MersenneTwister KoopaRandomGenerator::mt;
+namespace {
 
-std::vector<std::string> KoopaRandomGenerator::KOOPA_NAMES = {
+// x % d for a fixed d without a divide (Lemire, Kaser and Kurz, "Faster
+// remainder by direct computation"): exact for every 32-bit x and d > 0.
+__extension__ typedef unsigned __int128 uint128;
+
+struct FastMod {
+    uint64_t magic;
+    uint32_t d;
+
+    explicit FastMod(uint32_t divisor)
+      : magic(UINT64_MAX / divisor + 1), d(divisor) {}
+
+    uint32_t mod(uint32_t x) const {
+        uint64_t low = magic * x;
+        return static_cast<uint32_t>((static_cast<uint128>(low) * d) >> 64);
+    }
+};
+
+}
+
+const std::vector<std::string> KoopaRandomGenerator::KOOPA_NAMES = {
     "greenKoopa",
     "redKoopa",
     "spiny",
@@ -15,11 +38,17 @@ std::vector<std::string> KoopaRandomGenerator::KOOPA_NAMES = {
     "paraTroopa",
 };
 
-KoopaRandomGenerator::GenState KoopaRandomGenerator::genState;
-uint32_t KoopaRandomGenerator::koopaCounter;
-uint32_t KoopaRandomGenerator::maxRandDist;
-uint32_t KoopaRandomGenerator::maxRandSpeed;
-uint32_t KoopaRandomGenerator::maxRandHealth;
+KoopaRandomGenerator::KoopaRandomGenerator()
+  : genState(GenState::GenName), koopaCounter(0),
+    maxRandDist(0), maxRandSpeed(0), maxRandHealth(0) {}
+
+KoopaRandomGenerator::KoopaRandomGenerator(uint32_t seed,
+                                           uint32_t maxDist,
+                                           uint32_t maxSpeed,
+                                           uint32_t maxHealth)
+  : KoopaRandomGenerator() {
+    initialize(seed, maxDist, maxSpeed, maxHealth);
+}
 
 void KoopaRandomGenerator::initialize(uint32_t seed,
                                       uint32_t maxDist,
@@ -33,49 +62,173 @@ void KoopaRandomGenerator::initialize(uint32_t seed,
     mt.init_genrand(seed);
 }
 
-std::string KoopaRandomGenerator::getNextKoopaName() {
-    if (genState != GenState::GenName) {
-        std::cerr << "Koopa generator functions called out of order\n";
-        exit(1);
+void KoopaRandomGenerator::expect(GenState state, GenState next) {
+    if (genState != state) {
+        throw KoopaGeneratorError(
+            "Koopa generator functions called out of order");
     }
-    genState = GenState::GenDistance;
-    uint32_t idx = koopaCounter++;
-    const auto &baseName = KOOPA_NAMES[idx % KOOPA_NAMES.size()];
-    return baseName + std::to_string(idx);
+    genState = next;
+}
+
+std::string KoopaRandomGenerator::koopaName(uint32_t index) {
+    std::string name;
+    koopaName(index, name);
+    return name;
+}
+
+void KoopaRandomGenerator::koopaName(uint32_t index, std::string &out) {
+    char digits[10];
+    auto end = std::to_chars(digits, digits + sizeof digits, index).ptr;
+    out = KOOPA_NAMES[index % KOOPA_NAMES.size()];
+    out.append(digits, static_cast<size_t>(end - digits));
+}
+
+// No base name is a prefix of another, so the base decides first. The
+// decimal index then compares as a string does: padded with zeros to ten
+// digits, and on a tie (one is a prefix of the other) shorter first.
+uint64_t KoopaRandomGenerator::koopaNameKey(uint32_t index) {
+    static const std::vector<uint64_t> baseRank = [] {
+        std::vector<uint64_t> rank(KOOPA_NAMES.size(), 0);
+        for (size_t i = 0; i < KOOPA_NAMES.size(); i++) {
+            for (const std::string &other : KOOPA_NAMES) {
+                if (other < KOOPA_NAMES[i]) rank[i]++;
+            }
+        }
+        return rank;
+    }();
+    uint64_t digits = 1, padded = index;
+    for (uint32_t v = index; v >= 10; v /= 10) digits++;
+    for (uint64_t d = digits; d < 10; d++) padded *= 10;
+    return (baseRank[index % KOOPA_NAMES.size()] << 40) | (padded << 4) | digits;
+}
+
+uint32_t KoopaRandomGenerator::koopaNameIndex(uint64_t key) {
+    uint64_t padded = (key >> 4) & ((1ULL << 36) - 1);
+    for (uint64_t d = key & 15; d < 10; d++) padded /= 10;
+    return static_cast<uint32_t>(padded);
+}
+
+std::string KoopaRandomGenerator::getNextKoopaName() {
+    expect(GenState::GenName, GenState::GenDistance);
+    return koopaName(koopaCounter++);
 }
 
 uint32_t KoopaRandomGenerator::getNextKoopaDistance() {
-    if (genState != GenState::GenDistance) {
-        std::cerr << "Koopa generator functions called out of order\n";
-        exit(1);
-    }
-    genState = GenState::GenSpeed;
+    expect(GenState::GenDistance, GenState::GenSpeed);
     return getNextInt(maxRandDist);
 }
 
 uint32_t KoopaRandomGenerator::getNextKoopaSpeed() {
-    if (genState != GenState::GenSpeed) {
-        std::cerr << "Koopa generator functions called out of order\n";
-        exit(1);
-    }
-    genState = GenState::GenHealth;
+    expect(GenState::GenSpeed, GenState::GenHealth);
     return getNextInt(maxRandSpeed);
 }
 
 uint32_t KoopaRandomGenerator::getNextKoopaHealth() {
-    if (genState != GenState::GenHealth) {
-        std::cerr << "Koopa generator functions called out of order\n";
-        exit(1);
-    }
-    genState = GenState::GenName;
+    expect(GenState::GenHealth, GenState::GenName);
     return getNextInt(maxRandHealth);
 }
 
+uint32_t KoopaRandomGenerator::generateKoopas(size_t n, uint32_t *distance,
+                                              uint32_t *speed,
+                                              uint32_t *health) {
+    if (genState != GenState::GenName) {
+        throw KoopaGeneratorError(
+            "Koopa generator functions called out of order");
+    }
+    uint32_t first = koopaCounter;
+    if (n == 0) return first;
+    if (maxRandDist == 0 || maxRandSpeed == 0 || maxRandHealth == 0) {
+        throw KoopaGeneratorError("Koopa generator has a zero maximum");
+    }
+    const FastMod dist(maxRandDist), sp(maxRandSpeed), hp(maxRandHealth);
+    const size_t BLOCK = 512;
+    uint32_t raw[3 * BLOCK];
+    for (size_t done = 0; done < n; ) {
+        size_t count = std::min(BLOCK, n - done);
+        mt.generate(raw, 3 * count);
+        for (size_t i = 0; i < count; i++) {
+            distance[done + i] = dist.mod(raw[3 * i]) + 1;
+            speed[done + i] = sp.mod(raw[3 * i + 1]) + 1;
+            health[done + i] = hp.mod(raw[3 * i + 2]) + 1;
+        }
+        done += count;
+    }
+    koopaCounter += static_cast<uint32_t>(n);
+    return first;
+}
+
+uint32_t KoopaRandomGenerator::generateKoopas(size_t n, uint32_t *distance,
+                                              uint32_t *speed,
+                                              uint32_t *health,
+                                              unsigned threads) {
+    size_t chunks = std::min<size_t>(threads, n / PARALLEL_CHUNK);
+    if (chunks < 2) return generateKoopas(n, distance, speed, health);
+    if (genState != GenState::GenName) {
+        throw KoopaGeneratorError(
+            "Koopa generator functions called out of order");
+    }
+
+    // Chunk c starts c * n / chunks Koopas on; the generator ends where
+    // the last chunk does.
+    const State start = saveState();
+    State end;
+    parallelFor(0, chunks, static_cast<unsigned>(chunks),
+                [&](unsigned, uint64_t c) {
+        size_t lo = static_cast<size_t>(n * c / chunks);
+        size_t hi = static_cast<size_t>(n * (c + 1) / chunks);
+        KoopaRandomGenerator part;
+        part.restoreState(start);
+        part.skipKoopas(lo);
+        part.generateKoopas(hi - lo, distance + lo, speed + lo, health + lo);
+        if (c + 1 == chunks) end = part.saveState();
+    });
+    restoreState(end);
+    return start.koopaCounter;
+}
+
+void KoopaRandomGenerator::skipKoopas(uint64_t n) {
+    if (genState != GenState::GenName) {
+        throw KoopaGeneratorError(
+            "Koopa generator functions called out of order");
+    }
+    mt.jump(3 * n);
+    koopaCounter += static_cast<uint32_t>(n);
+}
+
 uint32_t KoopaRandomGenerator::getNextInt(uint32_t maxVal) {
+    if (maxVal == 0) {
+        throw KoopaGeneratorError("Koopa generator has a zero maximum");
+    }
     // Mersenne Twister usage: random in [1..maxVal]
     return (mt.genrand_uint32_t() % maxVal) + 1;
 }
 
+KoopaRandomGenerator::State KoopaRandomGenerator::saveState() const {
+    State s;
+    s.genState = static_cast<uint32_t>(genState);
+    s.koopaCounter = koopaCounter;
+    s.maxRandDist = maxRandDist;
+    s.maxRandSpeed = maxRandSpeed;
+    s.maxRandHealth = maxRandHealth;
+    mt.getState(s.mt, s.mti);
+    return s;
+}
+
+bool KoopaRandomGenerator::restoreState(const State &s) {
+    // A zero maximum is valid until a Koopa is drawn with it, which
+    // getNextInt() and generateKoopas() reject.
+    if (s.genState > static_cast<uint32_t>(GenState::GenHealth) ||
+        !mt.setState(s.mt, s.mti)) {
+        return false;
+    }
+    genState = static_cast<GenState>(s.genState);
+    koopaCounter = s.koopaCounter;
+    maxRandDist = s.maxRandDist;
+    maxRandSpeed = s.maxRandSpeed;
+    maxRandHealth = s.maxRandHealth;
+    return true;
+}
+
 /* The Mersenne Twister code plus license, adapted from
    Takuji Nishimura and Makoto Matsumoto, is retained below:
 */
@@ -99,29 +252,61 @@ void KoopaRandomGenerator::MersenneTwister::init_genrand(uint32_t s) {
     }
 }
 
+void KoopaRandomGenerator::MersenneTwister::getState(
+        std::vector<uint32_t> &words, uint32_t &index) const {
+    words.assign(mt_, mt_ + N);
+    index = mti_;
+}
+
+bool KoopaRandomGenerator::MersenneTwister::setState(
+        const std::vector<uint32_t> &words, uint32_t index) {
+    if (words.size() != N || index > N + 1) return false;
+    std::copy(words.begin(), words.end(), mt_);
+    mti_ = index;
+    return true;
+}
+
+// The twist and the tempering live in MersenneTwistKernel, which runs
+// them a block of words at a time.
 uint32_t KoopaRandomGenerator::MersenneTwister::genrand_uint32_t() {
-    uint32_t y;
-    static uint32_t mag01[2] = { 0x0U, MATRIX_A };
     if (mti_ >= N) {
-        uint32_t kk;
         if (mti_ == N + 1)
             init_genrand(5489U);
-        for (kk = 0; kk < N - M; kk++) {
-            y = (mt_[kk] & UPPER_MASK) | (mt_[kk + 1] & LOWER_MASK);
-            mt_[kk] = mt_[kk + M] ^ (y >> 1) ^ mag01[y & 1U];
-        }
-        for (; kk < N - 1; kk++) {
-            y = (mt_[kk] & UPPER_MASK) | (mt_[kk + 1] & LOWER_MASK);
-            mt_[kk] = mt_[kk + (M - N)] ^ (y >> 1) ^ mag01[y & 1U];
-        }
-        y = (mt_[N - 1] & UPPER_MASK) | (mt_[0] & LOWER_MASK);
-        mt_[N - 1] = mt_[M - 1] ^ (y >> 1) ^ mag01[y & 1U];
+        MersenneTwistKernel::twist(mt_);
         mti_ = 0;
     }
-    y = mt_[mti_++];
-    y ^= (y >> 11);
-    y ^= (y << 7) & 0x9d2c5680U;
-    y ^= (y << 15) & 0xefc60000U;
-    y ^= (y >> 18);
-    return y;
+    return MersenneTwistKernel::temper(mt_[mti_++]);
+}
+
+void KoopaRandomGenerator::MersenneTwister::generate(uint32_t *out, size_t n) {
+    while (n > 0) {
+        if (mti_ >= N) {
+            if (mti_ == N + 1)
+                init_genrand(5489U);
+            MersenneTwistKernel::twist(mt_);
+            mti_ = 0;
+        }
+        size_t take = std::min<size_t>(n, N - mti_);
+        MersenneTwistKernel::temper(mt_ + mti_, out, take);
+        mti_ += static_cast<uint32_t>(take);
+        out += take;
+        n -= take;
+    }
+}
+
+// Skips whole twists with MersenneTwistJump, leaving the index where n
+// single draws would: a twist happens only when a word is actually drawn.
+void KoopaRandomGenerator::MersenneTwister::jump(uint64_t n) {
+    if (n == 0) return;
+    if (mti_ == N + 1) {
+        init_genrand(5489U);
+    }
+    uint64_t total = mti_ + n;
+    if (total <= N) {
+        mti_ = static_cast<uint32_t>(total);
+        return;
+    }
+    uint64_t twists = (total - 1) / N;
+    MersenneTwistJump::advance(mt_, twists);
+    mti_ = static_cast<uint32_t>(total - twists * N);
 }
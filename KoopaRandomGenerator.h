@@ -2,20 +2,85 @@
 #define KOOPARANDOMGENERATOR_H
 
 #include <vector>
+#include <cstddef>
 #include <string>
+#include <stdexcept>
 #include <cstdint>
 
+// Thrown when the generator is used against its protocol: the four
+// getNext* calls for a Koopa must come in order, and a value cannot be
+// drawn from an empty range.
+class KoopaGeneratorError : public std::logic_error {
+public:
+    using std::logic_error::logic_error;
+};
+
+// Random Koopas for one game. All state lives in the object, so separate
+// games can each own a generator and run side by side on different
+// threads.
 class KoopaRandomGenerator {
 public:
-    static void initialize(uint32_t seed,
-                           uint32_t maxDist,
-                           uint32_t maxSpeed,
-                           uint32_t maxHealth);
+    KoopaRandomGenerator();
+    KoopaRandomGenerator(uint32_t seed,
+                         uint32_t maxDist,
+                         uint32_t maxSpeed,
+                         uint32_t maxHealth);
+
+    void initialize(uint32_t seed,
+                    uint32_t maxDist,
+                    uint32_t maxSpeed,
+                    uint32_t maxHealth);
+
+    std::string getNextKoopaName();
+    uint32_t getNextKoopaDistance();
+    uint32_t getNextKoopaSpeed();
+    uint32_t getNextKoopaHealth();
+
+    // Draws n whole Koopas at once: the same values n rounds of the four
+    // getNext* calls would return, written to distance[i], speed[i] and
+    // health[i]. Returns the index of the first one; Koopa i is named
+    // koopaName(first + i). Must be called between Koopas.
+    uint32_t generateKoopas(size_t n, uint32_t *distance,
+                            uint32_t *speed, uint32_t *health);
+
+    // The same, split into chunks that are generated on up to `threads`
+    // threads from jumped copies of the generator. Small batches are drawn
+    // on the calling thread.
+    uint32_t generateKoopas(size_t n, uint32_t *distance,
+                            uint32_t *speed, uint32_t *health,
+                            unsigned threads);
+
+    // Moves past the next n random Koopas without drawing them, in time
+    // logarithmic in n for large n. Must be called between Koopas.
+    void skipKoopas(uint64_t n);
+
+    // Per-thread batches below this many Koopas are not worth a jump.
+    static const size_t PARALLEL_CHUNK = 1 << 22;
 
-    static std::string getNextKoopaName();
-    static uint32_t getNextKoopaDistance();
-    static uint32_t getNextKoopaSpeed();
-    static uint32_t getNextKoopaHealth();
+    // Name of the index-th random Koopa, as getNextKoopaName() returns it.
+    static std::string koopaName(uint32_t index);
+    // The same, written over `out` so its buffer is reused.
+    static void koopaName(uint32_t index, std::string &out);
+
+    // Sort key for koopaName(index) without building it: keys compare
+    // exactly as the names do. koopaNameIndex() inverts it.
+    static uint64_t koopaNameKey(uint32_t index);
+    static uint32_t koopaNameIndex(uint64_t key);
+
+    // Everything the generator will produce from here on, for checkpoints.
+    struct State {
+        uint32_t genState;
+        uint32_t koopaCounter;
+        uint32_t maxRandDist;
+        uint32_t maxRandSpeed;
+        uint32_t maxRandHealth;
+        uint32_t mti;
+        std::vector<uint32_t> mt;
+    };
+
+    State saveState() const;
+    // Returns false (and changes nothing) if the state is inconsistent.
+    bool restoreState(const State &state);
 
 private:
     enum class GenState : char {
@@ -25,13 +90,14 @@ private:
         GenHealth
     };
 
-    static GenState genState;
-    static uint32_t koopaCounter;
-    static uint32_t maxRandDist,
-                    maxRandSpeed,
-                    maxRandHealth;
-    static std::vector<std::string> KOOPA_NAMES;
-    static uint32_t getNextInt(uint32_t);
+    GenState genState;
+    uint32_t koopaCounter;
+    uint32_t maxRandDist,
+             maxRandSpeed,
+             maxRandHealth;
+    static const std::vector<std::string> KOOPA_NAMES;
+    uint32_t getNextInt(uint32_t);
+    void expect(GenState state, GenState next);
 
     class MersenneTwister {
     public:
@@ -44,18 +110,23 @@ private:
         void init_genrand(uint32_t s);
         uint32_t genrand_uint32_t();
 
-    private:
+        // The next n outputs of genrand_uint32_t(), a block at a time.
+        void generate(uint32_t *out, size_t n);
+
+        // Advances as if genrand_uint32_t() were called n times.
+        void jump(uint64_t n);
+
+        void getState(std::vector<uint32_t> &words, uint32_t &index) const;
+        bool setState(const std::vector<uint32_t> &words, uint32_t index);
+
         static const uint32_t N = 624;
-        static const uint32_t M = 397;
-        static const uint32_t MATRIX_A = 0x9908b0dfU;
-        static const uint32_t UPPER_MASK = 0x80000000U;
-        static const uint32_t LOWER_MASK = 0x7fffffffU;
 
+    private:
         uint32_t *mt_;
         uint32_t mti_;
     };
 
-    static MersenneTwister mt;
+    MersenneTwister mt;
 };
 
 #endif
@@ -0,0 +1,230 @@
+// KoopaTrace.cpp   Binary event trace: encoder, frame reader and the
+// expander that turns frames back into verbose text.
+
+#include <algorithm>
+#include <cstring>
+#include <unistd.h>
+#include "ByteIo.h"
+#include "KoopaTrace.h"
+
+uint64_t KoopaTrace::zigzag(int64_t v) {
+    return (static_cast<uint64_t>(v) << 1) ^ static_cast<uint64_t>(v >> 63);
+}
+
+int64_t KoopaTrace::unzigzag(uint64_t v) {
+    return static_cast<int64_t>(v >> 1) ^ -static_cast<int64_t>(v & 1);
+}
+
+TraceWriter::TraceWriter(int fd)
+  : fd_(fd), out_(fd), round_(0), lastRound_(0), lastId_(0), open_(false) {
+    out_ << KoopaTrace::MAGIC << static_cast<char>(KoopaTrace::VERSION);
+}
+
+TraceWriter::~TraceWriter() {
+    endRound();
+    out_.flush();
+    close(fd_);
+}
+
+void TraceWriter::beginRound(uint32_t round) {
+    endRound();
+    round_ = round;
+    open_ = true;
+}
+
+void TraceWriter::moves(uint64_t moved, uint64_t distanceSum,
+                        std::vector<uint32_t> &breachedIds) {
+    frame_.push_back(static_cast<char>(KoopaTrace::MOVES));
+    ByteIo::putVarint(frame_, moved);
+    ByteIo::putVarint(frame_, distanceSum);
+    ByteIo::putVarint(frame_, breachedIds.size());
+    std::sort(breachedIds.begin(), breachedIds.end());
+    uint32_t prev = 0;
+    for (uint32_t id : breachedIds) {
+        ByteIo::putVarint(frame_, id - prev);
+        prev = id;
+    }
+}
+
+void TraceWriter::spawn(std::string_view name, uint32_t distance,
+                        uint32_t speed, uint32_t health) {
+    frame_.push_back(static_cast<char>(KoopaTrace::SPAWN));
+    ByteIo::putVarint(frame_, name.size());
+    frame_.append(name.data(), name.size());
+    ByteIo::putVarint(frame_, distance);
+    ByteIo::putVarint(frame_, speed);
+    ByteIo::putVarint(frame_, health);
+}
+
+void TraceWriter::knockOut(uint32_t id) {
+    frame_.push_back(static_cast<char>(KoopaTrace::KNOCKOUT));
+    ByteIo::putVarint(frame_, KoopaTrace::zigzag(
+        static_cast<int64_t>(id) - static_cast<int64_t>(lastId_)));
+    lastId_ = id;
+}
+
+void TraceWriter::damage(uint32_t id, uint32_t rocks) {
+    frame_.push_back(static_cast<char>(KoopaTrace::DAMAGE));
+    ByteIo::putVarint(frame_, KoopaTrace::zigzag(
+        static_cast<int64_t>(id) - static_cast<int64_t>(lastId_)));
+    ByteIo::putVarint(frame_, rocks);
+    lastId_ = id;
+}
+
+void TraceWriter::breach(uint32_t id) {
+    frame_.push_back(static_cast<char>(KoopaTrace::BREACH));
+    ByteIo::putVarint(frame_, id);
+}
+
+void TraceWriter::victory(bool any, uint32_t lastId) {
+    frame_.push_back(static_cast<char>(KoopaTrace::VICTORY));
+    ByteIo::putVarint(frame_, any ? static_cast<uint64_t>(lastId) + 1 : 0);
+}
+
+void TraceWriter::endRound() {
+    if (!open_) return;
+    std::string head;
+    ByteIo::putVarint(head, round_ - lastRound_);
+    ByteIo::putVarint(head, frame_.size());
+    out_ << head << frame_;
+    frame_.clear();
+    lastRound_ = round_;
+    open_ = false;
+}
+
+void TraceWriter::finish() {
+    endRound();
+    out_ << '\0' << '\0';
+}
+
+TraceReader::TraceReader(const char *begin, const char *end)
+  : rest_(begin, static_cast<size_t>(end - begin)), round_(0), valid_(false),
+    ended_(false) {
+    size_t magic = std::strlen(KoopaTrace::MAGIC);
+    if (rest_.size() > magic &&
+        rest_.compare(0, magic, KoopaTrace::MAGIC) == 0 &&
+        static_cast<uint8_t>(rest_[magic]) == KoopaTrace::VERSION) {
+        rest_.remove_prefix(magic + 1);
+        valid_ = true;
+    }
+}
+
+TraceReader::Status TraceReader::next(TraceFrame &frame) {
+    if (!valid_) return MALFORMED;
+    if (ended_) return rest_.empty() ? END : MALFORMED;
+    uint64_t delta, length;
+    if (!ByteIo::getVarint(rest_, delta) ||
+        !ByteIo::getVarint(rest_, length) || length > rest_.size()) {
+        return TRUNCATED;
+    }
+    if (delta == 0) {
+        if (length != 0) return MALFORMED;
+        ended_ = true;
+        return rest_.empty() ? END : MALFORMED;
+    }
+    round_ += static_cast<uint32_t>(delta);
+    frame.round = round_;
+    frame.payload = rest_.substr(0, static_cast<size_t>(length));
+    rest_.remove_prefix(static_cast<size_t>(length));
+    return FRAME;
+}
+
+void TraceExpander::line(std::string &text, const char *what, const State &k) {
+    text += what;
+    text += k.name;
+    text += " (distance: ";
+    text += std::to_string(k.distance);
+    text += ", speed: ";
+    text += std::to_string(k.speed);
+    text += ", health: ";
+    text += std::to_string(k.health);
+    text += ")\n";
+}
+
+bool TraceExpander::expand(const TraceFrame &frame, std::string &text) {
+    std::string_view in = frame.payload;
+    std::string round = std::to_string(frame.round);
+    text += "Round: " + round + "\n";
+    bool knocked = false;
+    while (!in.empty()) {
+        uint8_t event = static_cast<uint8_t>(in.front());
+        in.remove_prefix(1);
+        uint64_t a, b, c, d;
+        switch (event) {
+        case KoopaTrace::MOVES:
+            if (!ByteIo::getVarint(in, a) || !ByteIo::getVarint(in, b) ||
+                !ByteIo::getVarint(in, c)) {
+                return false;
+            }
+            for (uint64_t i = 0; i < c; i++) {
+                if (!ByteIo::getVarint(in, d)) return false;
+            }
+            for (uint32_t id : liveOrder_) {
+                State &k = koopas_[id];
+                k.distance -= std::min(k.distance, k.speed);
+                line(text, "Moved: ", k);
+            }
+            break;
+        case KoopaTrace::SPAWN: {
+            if (!ByteIo::getVarint(in, a) || a > in.size()) return false;
+            State k;
+            k.name.assign(in.data(), static_cast<size_t>(a));
+            in.remove_prefix(static_cast<size_t>(a));
+            if (!ByteIo::getVarint(in, b) || !ByteIo::getVarint(in, c) ||
+                !ByteIo::getVarint(in, d)) {
+                return false;
+            }
+            k.distance = static_cast<uint32_t>(b);
+            k.speed = static_cast<uint32_t>(c);
+            k.health = static_cast<uint32_t>(d);
+            k.live = true;
+            line(text, "Spawned: ", k);
+            liveOrder_.push_back(static_cast<uint32_t>(koopas_.size()));
+            koopas_.push_back(std::move(k));
+            break;
+        }
+        case KoopaTrace::KNOCKOUT:
+        case KoopaTrace::DAMAGE: {
+            if (!ByteIo::getVarint(in, a)) return false;
+            int64_t id = static_cast<int64_t>(lastId_) + KoopaTrace::unzigzag(a);
+            if (id < 0 || static_cast<uint64_t>(id) >= koopas_.size()) return false;
+            lastId_ = static_cast<uint32_t>(id);
+            State &k = koopas_[lastId_];
+            if (event == KoopaTrace::DAMAGE) {
+                if (!ByteIo::getVarint(in, b)) return false;
+                k.health -= static_cast<uint32_t>(b);
+            } else {
+                k.health = 0;
+                k.live = false;
+                knocked = true;
+                line(text, "Knocked Out: ", k);
+            }
+            break;
+        }
+        case KoopaTrace::BREACH:
+            if (!ByteIo::getVarint(in, a) || a >= koopas_.size()) return false;
+            text += "DEFEAT IN ROUND " + round + "! " +
+                    koopas_[static_cast<size_t>(a)].name + " reached the castle!\n";
+            break;
+        case KoopaTrace::VICTORY:
+            if (!ByteIo::getVarint(in, a) || a > koopas_.size()) return false;
+            text += "VICTORY IN ROUND " + round + "!";
+            if (a > 0) {
+                text += " " + koopas_[static_cast<size_t>(a - 1)].name +
+                        " was the final Koopa.";
+            }
+            text += "\n";
+            break;
+        default:
+            return false;
+        }
+    }
+    if (knocked) {
+        liveOrder_.erase(std::remove_if(liveOrder_.begin(), liveOrder_.end(),
+                                        [this](uint32_t id) {
+                                            return !koopas_[id].live;
+                                        }),
+                         liveOrder_.end());
+    }
+    return true;
+}
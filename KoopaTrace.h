@@ -0,0 +1,139 @@
+#ifndef KOOPATRACE_H
+#define KOOPATRACE_H
+
+#include <string>
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+#include "OutputWriter.h"
+
+// Compact binary record of a game, written by `game --trace FILE`.
+//
+//   file    := "KTRC" version:u8 frame* end
+//   frame   := roundDelta:varint payloadLength:varint event*
+//   end     := 0x00 0x00                (a frame no round can produce)
+//   event   := MOVES   moved:varint distanceSum:varint
+//                      breached:varint idDelta:varint*
+//            | SPAWN   nameLength:varint name distance speed health
+//            | KNOCKOUT idDelta:zigzag
+//            | DAMAGE  idDelta:zigzag rocks:varint
+//            | BREACH  id:varint
+//            | VICTORY lastKnockedOut+1:varint        (0 = none)
+//
+// Every round is one frame, so two traces can be compared round by round
+// without decoding. Koopas are identified by spawn order. Moves are
+// implied by the rules (every live Koopa steps min(distance, speed)); the
+// batch records how many moved, the sum of their distances afterwards and
+// which ones reached the castle, so a change in movement still shows up
+// as a different frame. Knock-out and damage ids are deltas from the last
+// id either of them named. The end marker is written once the game is
+// over, so a trace cut short anywhere, even between frames, is detected.
+class KoopaTrace {
+public:
+    static constexpr const char *MAGIC = "KTRC";
+    static constexpr uint8_t VERSION = 2;
+
+    enum Event : uint8_t {
+        MOVES    = 1,
+        SPAWN    = 2,
+        KNOCKOUT = 3,
+        DAMAGE   = 4,
+        BREACH   = 5,
+        VICTORY  = 6
+    };
+
+    static uint64_t zigzag(int64_t v);
+    static int64_t unzigzag(uint64_t v);
+};
+
+// Writes the trace of one game. Events are collected for the current round
+// and emitted as a frame by endRound().
+class TraceWriter {
+public:
+    explicit TraceWriter(int fd);
+    ~TraceWriter();
+
+    TraceWriter(const TraceWriter&) = delete;
+    TraceWriter &operator=(const TraceWriter&) = delete;
+
+    void beginRound(uint32_t round);
+    void moves(uint64_t moved, uint64_t distanceSum,
+               std::vector<uint32_t> &breachedIds);
+    void spawn(std::string_view name, uint32_t distance,
+               uint32_t speed, uint32_t health);
+    void knockOut(uint32_t id);
+    void damage(uint32_t id, uint32_t rocks);
+    void breach(uint32_t id);
+    void victory(bool any, uint32_t lastId);
+    void endRound();
+    // Ends the last round and writes the end marker.
+    void finish();
+
+private:
+    int fd_;
+    OutputWriter out_;
+    std::string frame_;
+    uint32_t round_;
+    uint32_t lastRound_;
+    uint32_t lastId_;
+    bool open_;
+};
+
+// One round of a trace, still encoded.
+struct TraceFrame {
+    uint32_t round = 0;
+    std::string_view payload;
+};
+
+// Splits a trace held in memory into frames.
+class TraceReader {
+public:
+    TraceReader(const char *begin, const char *end);
+
+    // False if the buffer does not start with a trace header.
+    bool valid() const { return valid_; }
+
+    enum Status {
+        FRAME,      // `frame` holds the next round
+        END,        // the end marker, with nothing after it
+        TRUNCATED,  // the data stops before the end marker
+        MALFORMED   // a bad frame header, or data after the end marker
+    };
+
+    Status next(TraceFrame &frame);
+
+    // The last round read, for error messages.
+    uint32_t round() const { return round_; }
+
+private:
+    std::string_view rest_;
+    uint32_t round_;
+    bool valid_;
+    bool ended_;
+};
+
+// Replays frames and renders the text `game --verbose` prints for them:
+// the Round, Moved, Spawned, Knocked Out, DEFEAT and VICTORY lines.
+class TraceExpander {
+public:
+    // Appends the lines of `frame` to `text`. Returns false if the payload
+    // is malformed.
+    bool expand(const TraceFrame &frame, std::string &text);
+
+private:
+    struct State {
+        std::string name;
+        uint32_t distance;
+        uint32_t speed;
+        uint32_t health;
+        bool     live;
+    };
+    std::vector<State> koopas_;
+    std::vector<uint32_t> liveOrder_;
+    uint32_t lastId_ = 0;
+
+    static void line(std::string &text, const char *what, const State &k);
+};
+
+#endif
@@ -0,0 +1,226 @@
+// MersenneTwistJump.cpp   Polynomial skip-ahead for MT19937.
+
+#include <vector>
+#include "MersenneTwistJump.h"
+#include "MersenneTwistKernel.h"
+
+namespace {
+
+typedef MersenneTwistKernel MTK;
+
+// Degree of the MT19937 characteristic polynomial (the period exponent).
+const size_t DEGREE = 19937;
+
+// Bit vectors over GF(2), bit i of word i / 64 is the coefficient of x^i.
+typedef std::vector<uint64_t> Poly;
+
+const size_t POLY_WORDS = DEGREE / 64 + 1;          // up to x^DEGREE
+const size_t PRODUCT_WORDS = 2 * DEGREE / 64 + 1;   // squares before reduction
+
+inline bool bit(const Poly &p, size_t i) {
+    return (p[i / 64] >> (i % 64)) & 1;
+}
+
+// dst ^= src * x^shift, dropping words past dst's end.
+void xorShifted(Poly &dst, const Poly &src, size_t srcWords, size_t shift) {
+    size_t ws = shift / 64;
+    unsigned bs = static_cast<unsigned>(shift % 64);
+    for (size_t i = 0; i < srcWords && i + ws < dst.size(); i++) {
+        dst[i + ws] ^= src[i] << bs;
+        if (bs != 0 && i + ws + 1 < dst.size()) {
+            dst[i + ws + 1] ^= src[i] >> (64 - bs);
+        }
+    }
+}
+
+// The window (x_t, ..., x_{t+N-1}) of the MT recurrence in a ring buffer
+// whose oldest word is at `head`. step() moves it to t + 1.
+struct Window {
+    uint32_t w[MTK::N];
+    unsigned head;
+
+    void step() {
+        unsigned next = head + 1 == MTK::N ? 0 : head + 1;
+        unsigned far = head + MTK::M >= MTK::N ? head + MTK::M - MTK::N
+                                               : head + MTK::M;
+        uint32_t y = (w[head] & MTK::UPPER_MASK) | (w[next] & MTK::LOWER_MASK);
+        w[head] = w[far] ^ (y >> 1) ^ ((0U - (y & 1U)) & MTK::MATRIX_A);
+        head = next;
+    }
+
+    // Adds `o` word for word in window order.
+    void add(const Window &o) {
+        unsigned d = (o.head + MTK::N - head) % MTK::N;
+        unsigned i = 0;
+        for (; i < MTK::N - d; i++) w[i] ^= o.w[i + d];
+        for (; i < MTK::N; i++) w[i] ^= o.w[i + d - MTK::N];
+    }
+};
+
+// Minimal polynomial of the low bit of the raw MT words, found with
+// Berlekamp-Massey. MT19937's characteristic polynomial is primitive, so
+// any nonzero bit sequence of the generator has it as minimal polynomial.
+// Empty if the result does not have the expected degree.
+Poly findCharacteristic() {
+    const size_t LENGTH = 2 * DEGREE + 2 * MTK::N;
+    std::vector<uint8_t> s;
+    s.reserve(LENGTH);
+    uint32_t mt[MTK::N];
+    mt[0] = 5489U;
+    for (uint32_t i = 1; i < MTK::N; i++) {
+        mt[i] = 1812433253U * (mt[i - 1] ^ (mt[i - 1] >> 30)) + i;
+    }
+    while (s.size() < LENGTH) {
+        MTK::twistScalar(mt);
+        for (uint32_t i = 0; i < MTK::N; i++) {
+            s.push_back(static_cast<uint8_t>(mt[i] & 1U));
+        }
+    }
+
+    // Connection polynomial C (s_n = sum C_i s_{n-i}), the previous one B,
+    // and R holding s_n at bit 0 and s_{n-i} at bit i.
+    const size_t WORDS = POLY_WORDS + 8;
+    Poly c(WORDS, 0), b(WORDS, 0), r(WORDS, 0), t;
+    c[0] = b[0] = 1;
+    size_t len = 0, m = 1;
+    for (size_t n = 0; n < LENGTH; n++) {
+        for (size_t i = WORDS - 1; i > 0; i--) {
+            r[i] = (r[i] << 1) | (r[i - 1] >> 63);
+        }
+        r[0] = (r[0] << 1) | s[n];
+        uint64_t acc = 0;
+        for (size_t i = 0; i < WORDS; i++) acc ^= c[i] & r[i];
+        if (__builtin_parityll(acc) == 0) {
+            m++;
+        } else if (2 * len <= n) {
+            t = c;
+            xorShifted(c, b, WORDS, m);
+            len = n + 1 - len;
+            b = t;
+            m = 1;
+        } else {
+            xorShifted(c, b, WORDS, m);
+            m++;
+        }
+    }
+    if (len != DEGREE) return Poly();
+
+    // phi(x) = x^L C(1/x).
+    Poly phi(POLY_WORDS, 0);
+    for (size_t k = 0; k <= DEGREE; k++) {
+        if (bit(c, DEGREE - k)) phi[k / 64] |= 1ULL << (k % 64);
+    }
+    return phi;
+}
+
+// p <- p * x mod phi.
+void timesXMod(Poly &p, const Poly &phi) {
+    for (size_t i = POLY_WORDS - 1; i > 0; i--) {
+        p[i] = (p[i] << 1) | (p[i - 1] >> 63);
+    }
+    p[0] <<= 1;
+    if (bit(p, DEGREE)) {
+        for (size_t i = 0; i < POLY_WORDS; i++) p[i] ^= phi[i];
+    }
+}
+
+// phi and, for reducing a byte of high coefficients at once, the table
+// byteTimesXL[v] = v(x) * x^DEGREE mod phi.
+struct Modulus {
+    Poly phi;
+    std::vector<Poly> byteTimesXL;
+
+    Modulus() : phi(findCharacteristic()) {
+        if (phi.empty()) return;
+        Poly xl(POLY_WORDS, 0);           // x^(DEGREE + j) mod phi
+        xl[0] = 1;
+        for (size_t i = 0; i < DEGREE; i++) timesXMod(xl, phi);
+        byteTimesXL.assign(256, Poly(POLY_WORDS, 0));
+        for (unsigned j = 0; j < 8; j++) {
+            for (unsigned v = 1u << j; v < (2u << j); v++) {
+                Poly &e = byteTimesXL[v];
+                e = byteTimesXL[v ^ (1u << j)];
+                for (size_t i = 0; i < POLY_WORDS; i++) e[i] ^= xl[i];
+            }
+            timesXMod(xl, phi);
+        }
+    }
+};
+
+const Modulus &modulus() {
+    static const Modulus m;
+    return m;
+}
+
+// p <- p^2 mod phi. Squaring over GF(2) spreads bit i to bit 2i; the
+// coefficients from x^DEGREE up are then folded back a byte at a time,
+// from the top down, so each fold only adds below the byte it removes.
+void squareMod(Poly &p, Poly &sq, const Modulus &mod) {
+    sq.assign(PRODUCT_WORDS + 1, 0);
+    for (size_t i = 0; i < POLY_WORDS; i++) {
+        for (unsigned half = 0; half < 2; half++) {
+            uint64_t v = (p[i] >> (32 * half)) & 0xffffffffULL;
+            v = (v | (v << 16)) & 0x0000ffff0000ffffULL;
+            v = (v | (v << 8))  & 0x00ff00ff00ff00ffULL;
+            v = (v | (v << 4))  & 0x0f0f0f0f0f0f0f0fULL;
+            v = (v | (v << 2))  & 0x3333333333333333ULL;
+            v = (v | (v << 1))  & 0x5555555555555555ULL;
+            sq[2 * i + half] = v;
+        }
+    }
+    for (size_t k = (DEGREE + 7) / 8; k-- > 0;) {
+        size_t pos = DEGREE + 8 * k;
+        size_t w = pos / 64;
+        unsigned b = static_cast<unsigned>(pos % 64);
+        uint64_t bits = sq[w] >> b;
+        if (b > 56) bits |= sq[w + 1] << (64 - b);
+        unsigned v = static_cast<unsigned>(bits & 0xff);
+        if (v != 0) xorShifted(sq, mod.byteTimesXL[v], POLY_WORDS, 8 * k);
+    }
+    p.assign(sq.begin(), sq.begin() + static_cast<ptrdiff_t>(POLY_WORDS));
+    p[DEGREE / 64] &= (1ULL << (DEGREE % 64)) - 1;
+}
+
+// x^e mod phi by left-to-right binary powering.
+Poly powerOfX(uint64_t e, const Modulus &mod) {
+    Poly p(POLY_WORDS, 0), scratch;
+    p[0] = 1;
+    bool started = false;
+    for (int b = 63; b >= 0; b--) {
+        if (started) squareMod(p, scratch, mod);
+        if ((e >> b) & 1) {
+            timesXMod(p, mod.phi);
+            started = true;
+        }
+    }
+    return p;
+}
+
+}
+
+void MersenneTwistJump::advance(uint32_t *mt, uint64_t twists) {
+    if (twists < POLYNOMIAL_THRESHOLD || modulus().phi.empty()) {
+        for (uint64_t i = 0; i < twists; i++) MTK::twist(mt);
+        return;
+    }
+
+    // One step first: the step drops the low 31 bits of the oldest word,
+    // and on what remains phi(T) = 0, so the other D - 1 steps are
+    // p(T) with p = x^(D-1) mod phi, evaluated by Horner's rule.
+    Window start;
+    for (unsigned i = 0; i < MTK::N; i++) start.w[i] = mt[i];
+    start.head = 0;
+    start.step();
+
+    Poly p = powerOfX(twists * MTK::N - 1, modulus());
+    Window acc;
+    for (unsigned i = 0; i < MTK::N; i++) acc.w[i] = 0;
+    acc.head = 0;
+    for (size_t k = DEGREE; k-- > 0;) {
+        acc.step();
+        if (bit(p, k)) acc.add(start);
+    }
+    for (unsigned i = 0; i < MTK::N; i++) {
+        mt[i] = acc.w[(acc.head + i) % MTK::N];
+    }
+}
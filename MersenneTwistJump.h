@@ -0,0 +1,23 @@
+#ifndef MERSENNETWISTJUMP_H
+#define MERSENNETWISTJUMP_H
+
+#include <cstdint>
+
+// Moves an MT19937 state array forward by whole twists. Short distances
+// are walked with the block twist; long ones use polynomial skip-ahead:
+// the state after t steps is p(T) applied to the state, where T is the
+// one-word step and p = x^t mod phi, phi being the characteristic
+// polynomial of MT19937. That costs O(log t) polynomial squarings plus one
+// Horner pass over phi's 19937 coefficients, independent of t.
+class MersenneTwistJump {
+public:
+    // Replaces the N-word array mt with its state `twists` full twists on,
+    // exactly as calling MersenneTwistKernel::twist that many times would.
+    static void advance(uint32_t *mt, uint64_t twists);
+
+    // Twists below this count are cheaper to walk than to jump (a jump
+    // costs about as much as 100k twists).
+    static const uint64_t POLYNOMIAL_THRESHOLD = 1 << 17;
+};
+
+#endif
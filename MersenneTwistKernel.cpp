@@ -0,0 +1,173 @@
+// MersenneTwistKernel.cpp   MT19937 twist and tempering with SSE2/AVX2 paths.
+
+#include "MersenneTwistKernel.h"
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#define MT_KERNEL_X86 1
+#endif
+
+namespace {
+
+typedef MersenneTwistKernel MTK;
+
+// mt[k] for k in [lo, hi), reading the partner word at k + off. The
+// partner is either still old (off = M) or was already rewritten at least
+// N - M words earlier (off = M - N), so blocks narrower than N - M see
+// exactly what the one-word recurrence sees.
+inline void twistRangeScalar(uint32_t *mt, size_t lo, size_t hi,
+                             ptrdiff_t off) {
+    for (size_t k = lo; k < hi; k++) {
+        uint32_t y = (mt[k] & MTK::UPPER_MASK) | (mt[k + 1] & MTK::LOWER_MASK);
+        mt[k] = mt[static_cast<ptrdiff_t>(k) + off] ^ (y >> 1) ^
+                ((0U - (y & 1U)) & MTK::MATRIX_A);
+    }
+}
+
+inline void twistLast(uint32_t *mt) {
+    uint32_t y = (mt[MTK::N - 1] & MTK::UPPER_MASK) | (mt[0] & MTK::LOWER_MASK);
+    mt[MTK::N - 1] = mt[MTK::M - 1] ^ (y >> 1) ^
+                     ((0U - (y & 1U)) & MTK::MATRIX_A);
+}
+
+#ifdef MT_KERNEL_X86
+
+void twistRangeSse2(uint32_t *mt, size_t lo, size_t hi, ptrdiff_t off) {
+    const __m128i upper = _mm_set1_epi32(static_cast<int>(MTK::UPPER_MASK));
+    const __m128i lower = _mm_set1_epi32(static_cast<int>(MTK::LOWER_MASK));
+    const __m128i matrix = _mm_set1_epi32(static_cast<int>(MTK::MATRIX_A));
+    size_t k = lo;
+    for (; k + 4 <= hi; k += 4) {
+        __m128i cur = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mt + k));
+        __m128i next = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mt + k + 1));
+        __m128i far = _mm_loadu_si128(reinterpret_cast<const __m128i*>(
+                          mt + static_cast<ptrdiff_t>(k) + off));
+        __m128i y = _mm_or_si128(_mm_and_si128(cur, upper),
+                                 _mm_and_si128(next, lower));
+        // All ones where the low bit of y is set.
+        __m128i odd = _mm_srai_epi32(_mm_slli_epi32(y, 31), 31);
+        __m128i r = _mm_xor_si128(_mm_xor_si128(far, _mm_srli_epi32(y, 1)),
+                                  _mm_and_si128(odd, matrix));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(mt + k), r);
+    }
+    twistRangeScalar(mt, k, hi, off);
+}
+
+void twistSse2(uint32_t *mt) {
+    twistRangeSse2(mt, 0, MTK::N - MTK::M, MTK::M);
+    twistRangeSse2(mt, MTK::N - MTK::M, MTK::N - 1,
+                   static_cast<ptrdiff_t>(MTK::M) - MTK::N);
+    twistLast(mt);
+}
+
+__attribute__((target("avx2")))
+void twistRangeAvx2(uint32_t *mt, size_t lo, size_t hi, ptrdiff_t off) {
+    const __m256i upper = _mm256_set1_epi32(static_cast<int>(MTK::UPPER_MASK));
+    const __m256i lower = _mm256_set1_epi32(static_cast<int>(MTK::LOWER_MASK));
+    const __m256i matrix = _mm256_set1_epi32(static_cast<int>(MTK::MATRIX_A));
+    size_t k = lo;
+    for (; k + 8 <= hi; k += 8) {
+        __m256i cur = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mt + k));
+        __m256i next = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mt + k + 1));
+        __m256i far = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(
+                          mt + static_cast<ptrdiff_t>(k) + off));
+        __m256i y = _mm256_or_si256(_mm256_and_si256(cur, upper),
+                                    _mm256_and_si256(next, lower));
+        __m256i odd = _mm256_srai_epi32(_mm256_slli_epi32(y, 31), 31);
+        __m256i r = _mm256_xor_si256(_mm256_xor_si256(far, _mm256_srli_epi32(y, 1)),
+                                     _mm256_and_si256(odd, matrix));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(mt + k), r);
+    }
+    twistRangeScalar(mt, k, hi, off);
+}
+
+__attribute__((target("avx2")))
+void twistAvx2(uint32_t *mt) {
+    twistRangeAvx2(mt, 0, MTK::N - MTK::M, MTK::M);
+    twistRangeAvx2(mt, MTK::N - MTK::M, MTK::N - 1,
+                   static_cast<ptrdiff_t>(MTK::M) - MTK::N);
+    twistLast(mt);
+}
+
+void temperSse2(const uint32_t *mt, uint32_t *out, size_t n) {
+    const __m128i b = _mm_set1_epi32(static_cast<int>(0x9d2c5680U));
+    const __m128i c = _mm_set1_epi32(static_cast<int>(0xefc60000U));
+    size_t i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m128i y = _mm_loadu_si128(reinterpret_cast<const __m128i*>(mt + i));
+        y = _mm_xor_si128(y, _mm_srli_epi32(y, 11));
+        y = _mm_xor_si128(y, _mm_and_si128(_mm_slli_epi32(y, 7), b));
+        y = _mm_xor_si128(y, _mm_and_si128(_mm_slli_epi32(y, 15), c));
+        y = _mm_xor_si128(y, _mm_srli_epi32(y, 18));
+        _mm_storeu_si128(reinterpret_cast<__m128i*>(out + i), y);
+    }
+    for (; i < n; i++) out[i] = MTK::temper(mt[i]);
+}
+
+__attribute__((target("avx2")))
+void temperAvx2(const uint32_t *mt, uint32_t *out, size_t n) {
+    const __m256i b = _mm256_set1_epi32(static_cast<int>(0x9d2c5680U));
+    const __m256i c = _mm256_set1_epi32(static_cast<int>(0xefc60000U));
+    size_t i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m256i y = _mm256_loadu_si256(reinterpret_cast<const __m256i*>(mt + i));
+        y = _mm256_xor_si256(y, _mm256_srli_epi32(y, 11));
+        y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_slli_epi32(y, 7), b));
+        y = _mm256_xor_si256(y, _mm256_and_si256(_mm256_slli_epi32(y, 15), c));
+        y = _mm256_xor_si256(y, _mm256_srli_epi32(y, 18));
+        _mm256_storeu_si256(reinterpret_cast<__m256i*>(out + i), y);
+    }
+    for (; i < n; i++) out[i] = MTK::temper(mt[i]);
+}
+
+#else
+
+void temperScalar(const uint32_t *mt, uint32_t *out, size_t n) {
+    for (size_t i = 0; i < n; i++) out[i] = MTK::temper(mt[i]);
+}
+
+#endif
+
+typedef void (*TwistFn)(uint32_t*);
+typedef void (*TemperFn)(const uint32_t*, uint32_t*, size_t);
+
+struct Dispatch {
+    TwistFn twist;
+    TemperFn temper;
+    const char *name;
+};
+
+Dispatch pickPath() {
+#ifdef MT_KERNEL_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx2")) return { twistAvx2, temperAvx2, "avx2" };
+    return { twistSse2, temperSse2, "sse2" };
+#else
+    return { MersenneTwistKernel::twistScalar, temperScalar, "scalar" };
+#endif
+}
+
+const Dispatch &dispatch() {
+    static const Dispatch chosen = pickPath();
+    return chosen;
+}
+
+}
+
+void MersenneTwistKernel::twistScalar(uint32_t *mt) {
+    twistRangeScalar(mt, 0, N - M, M);
+    twistRangeScalar(mt, N - M, N - 1, static_cast<ptrdiff_t>(M) - N);
+    twistLast(mt);
+}
+
+void MersenneTwistKernel::twist(uint32_t *mt) {
+    dispatch().twist(mt);
+}
+
+void MersenneTwistKernel::temper(const uint32_t *mt, uint32_t *out, size_t n) {
+    dispatch().temper(mt, out, n);
+}
+
+const char *MersenneTwistKernel::pathName() {
+    return dispatch().name;
+}
@@ -0,0 +1,38 @@
+#ifndef MERSENNETWISTKERNEL_H
+#define MERSENNETWISTKERNEL_H
+
+#include <cstddef>
+#include <cstdint>
+
+// Block operations on an MT19937 state of N words. The SSE2 and AVX2
+// paths are picked once at runtime; every path produces the same words as
+// the reference recurrence.
+class MersenneTwistKernel {
+public:
+    static const uint32_t N = 624;
+    static const uint32_t M = 397;
+    static const uint32_t MATRIX_A = 0x9908b0dfU;
+    static const uint32_t UPPER_MASK = 0x80000000U;
+    static const uint32_t LOWER_MASK = 0x7fffffffU;
+
+    // Regenerates all N words of mt in place: one full twist.
+    static void twist(uint32_t *mt);
+
+    // out[i] = temper(mt[i]) for every i < n.
+    static void temper(const uint32_t *mt, uint32_t *out, size_t n);
+
+    static uint32_t temper(uint32_t y) {
+        y ^= (y >> 11);
+        y ^= (y << 7) & 0x9d2c5680U;
+        y ^= (y << 15) & 0xefc60000U;
+        y ^= (y >> 18);
+        return y;
+    }
+
+    // Name of the path twist() dispatches to ("avx2", "sse2", "scalar").
+    static const char *pathName();
+
+    static void twistScalar(uint32_t *mt);
+};
+
+#endif
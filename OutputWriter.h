@@ -0,0 +1,80 @@
+#ifndef OUTPUTWRITER_H
+#define OUTPUTWRITER_H
+
+#include <charconv>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <cstddef>
+#include <cstring>
+#include <unistd.h>
+#include "ByteIo.h"
+
+// Buffered writer for the game's text output. Text is appended to one
+// large reusable buffer, integers are formatted with to_chars, and the
+// buffer goes out with write(2) when it fills, on flush() and on
+// destruction. A negative fd discards everything.
+class OutputWriter {
+public:
+    explicit OutputWriter(int fd = STDOUT_FILENO, size_t capacity = 1 << 20)
+      : fd_(fd), buf_(capacity < 64 ? 64 : capacity), used_(0) {}
+
+    ~OutputWriter() { flush(); }
+
+    OutputWriter(const OutputWriter&) = delete;
+    OutputWriter &operator=(const OutputWriter&) = delete;
+
+    OutputWriter &operator<<(std::string_view s) {
+        if (s.size() > buf_.size() - used_) {
+            flush();
+            if (s.size() > buf_.size()) {
+                writeAll(s.data(), s.size());
+                return *this;
+            }
+        }
+        std::memcpy(buf_.data() + used_, s.data(), s.size());
+        used_ += s.size();
+        return *this;
+    }
+
+    OutputWriter &operator<<(const char *s) {
+        return *this << std::string_view(s);
+    }
+
+    OutputWriter &operator<<(char c) {
+        if (used_ == buf_.size()) flush();
+        buf_[used_++] = c;
+        return *this;
+    }
+
+    template <typename T>
+    typename std::enable_if<std::is_integral<T>::value &&
+                            !std::is_same<T, char>::value &&
+                            !std::is_same<T, bool>::value,
+                            OutputWriter&>::type
+    operator<<(T v) {
+        // 20 digits and a sign cover any 64-bit integer.
+        if (buf_.size() - used_ < 21) flush();
+        char *p = buf_.data() + used_;
+        used_ += static_cast<size_t>(std::to_chars(p, p + 21, v).ptr - p);
+        return *this;
+    }
+
+    void flush() {
+        if (used_ > 0) writeAll(buf_.data(), used_);
+        used_ = 0;
+    }
+
+private:
+    int fd_;
+    std::vector<char> buf_;
+    size_t used_;
+
+    void writeAll(const char *p, size_t n) {
+        if (fd_ < 0) return;
+        // Broken pipe or closed stdout: drop the rest.
+        if (!ByteIo::writeAll(fd_, p, n)) fd_ = -1;
+    }
+};
+
+#endif
@@ -0,0 +1,172 @@
+// PhaseProfile.cpp   Phase timings and round counters for `game --profile`.
+
+#include <chrono>
+#include <cstdio>
+#include <unistd.h>
+#include "PhaseProfile.h"
+
+namespace {
+
+// Cycle counter ticks per steady-clock nanosecond, over a short spin.
+double measureNsPerTick() {
+    typedef std::chrono::steady_clock Clock;
+    Clock::time_point t0 = Clock::now();
+    uint64_t c0 = PhaseProfiler::now();
+    Clock::time_point t1;
+    do {
+        t1 = Clock::now();
+    } while (t1 - t0 < std::chrono::milliseconds(5));
+    uint64_t c1 = PhaseProfiler::now();
+    double ns = std::chrono::duration<double, std::nano>(t1 - t0).count();
+    return c1 > c0 ? ns / static_cast<double>(c1 - c0) : 1.0;
+}
+
+}
+
+PhaseProfiler::PhaseProfiler(int traceFd)
+  : nsPerTick_(measureNsPerTick()), origin_(now()), round_(0), rounds_(0),
+    roundStart_(0), roundTicks_(0), open_(false), roundCounts_(), totals_(),
+    traceFd_(traceFd), firstEvent_(true) {
+    if (traceFd_ >= 0) {
+        trace_.reset(new OutputWriter(traceFd_));
+        *trace_ << "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n";
+    }
+}
+
+PhaseProfiler::~PhaseProfiler() {
+    endRound();
+    if (trace_) {
+        *trace_ << "\n]}\n";
+        trace_->flush();
+        close(traceFd_);
+    }
+}
+
+const char *PhaseProfiler::phaseName(Phase p) {
+    static const char *names[PHASES] = {
+        "moveKoopas", "spawnKoopas", "throwRocks", "lifetimes",
+        "printStats", "checkpoint"
+    };
+    return names[p];
+}
+
+const char *PhaseProfiler::counterName(Counter c) {
+    static const char *names[COUNTERS] = {
+        "Koopas moved", "heap pushes", "heap pops", "heap key updates",
+        "rocks thrown"
+    };
+    return names[c];
+}
+
+uint64_t PhaseProfiler::toNs(uint64_t ticks) const {
+    return static_cast<uint64_t>(static_cast<double>(ticks) * nsPerTick_);
+}
+
+// One clock read both ends the last round and starts this one.
+void PhaseProfiler::beginRound(uint32_t round) {
+    uint64_t start = now();
+    closeRound(start);
+    round_ = round;
+    roundStart_ = start;
+    open_ = true;
+}
+
+void PhaseProfiler::phase(Phase p, uint64_t start, uint64_t end) {
+    uint64_t ticks = end - start;
+    PhaseTotal &t = phases_[p];
+    t.calls++;
+    t.ticks += ticks;
+    if (ticks > t.maxTicks) t.maxTicks = ticks;
+    if (trace_) {
+        beginEvent(phaseName(p), 'X', start);
+        *trace_ << ",\"dur\":";
+        putMicros(toNs(ticks));
+        *trace_ << ",\"args\":{\"round\":" << round_ << "}}";
+    }
+}
+
+void PhaseProfiler::endRound() {
+    if (open_) closeRound(now());
+}
+
+void PhaseProfiler::closeRound(uint64_t end) {
+    if (!open_) return;
+    open_ = false;
+    rounds_++;
+    roundTicks_ += end - roundStart_;
+    for (unsigned c = 0; c < COUNTERS; c++) totals_[c] += roundCounts_[c];
+    if (trace_) {
+        beginEvent("round", 'X', roundStart_);
+        *trace_ << ",\"dur\":";
+        putMicros(toNs(end - roundStart_));
+        *trace_ << ",\"args\":{\"round\":" << round_ << "}}";
+        beginEvent("counters", 'C', roundStart_);
+        *trace_ << ",\"args\":{";
+        for (unsigned c = 0; c < COUNTERS; c++) {
+            *trace_ << (c ? ",\"" : "\"") << counterName(Counter(c))
+                    << "\":" << roundCounts_[c];
+        }
+        *trace_ << "}}";
+    }
+    for (uint64_t &n : roundCounts_) n = 0;
+}
+
+// {"name":..,"ph":..,"pid":1,"tid":1,"ts":..  (left open for the rest)
+void PhaseProfiler::beginEvent(const char *name, char type, uint64_t at) {
+    *trace_ << (firstEvent_ ? "" : ",\n") << "{\"name\":\"" << name
+            << "\",\"ph\":\"" << type << "\",\"pid\":1,\"tid\":1,\"ts\":";
+    putMicros(toNs(at - origin_));
+    firstEvent_ = false;
+}
+
+// Chrome trace times are in microseconds; keep nanosecond precision.
+void PhaseProfiler::putMicros(uint64_t ns) {
+    char frac[4];
+    snprintf(frac, sizeof frac, "%03u", static_cast<unsigned>(ns % 1000));
+    *trace_ << ns / 1000 << '.' << frac;
+}
+
+void PhaseProfiler::printSummary(std::ostream &os) const {
+    uint64_t roundNs = toNs(roundTicks_);
+    uint64_t phaseTicks = 0;
+    char line[128];
+    os << "Profile of " << rounds_ << " rounds, "
+       << static_cast<double>(roundNs) / 1e6 << " ms\n";
+    snprintf(line, sizeof line, "%-12s %10s %12s %7s %12s %12s\n", "phase",
+             "calls", "total ms", "share", "mean us", "max us");
+    os << line;
+    auto row = [&](const char *name, uint64_t calls, uint64_t ticks,
+                   uint64_t maxTicks) {
+        double ns = static_cast<double>(toNs(ticks));
+        snprintf(line, sizeof line, "%-12s %10llu %12.3f %6.1f%% %12.3f",
+                 name, static_cast<unsigned long long>(calls), ns / 1e6,
+                 roundNs ? 100 * ns / static_cast<double>(roundNs) : 0.0,
+                 calls ? ns / 1e3 / static_cast<double>(calls) : 0.0);
+        os << line;
+        if (maxTicks > 0) {
+            snprintf(line, sizeof line, " %12.3f",
+                     static_cast<double>(toNs(maxTicks)) / 1e3);
+            os << line;
+        }
+        os << "\n";
+    };
+    for (unsigned p = 0; p < PHASES; p++) {
+        const PhaseTotal &t = phases_[p];
+        if (t.calls == 0) continue;
+        row(phaseName(Phase(p)), t.calls, t.ticks, t.maxTicks);
+        phaseTicks += t.ticks;
+    }
+    // Round bookkeeping, victory checks, early decisions and margins.
+    row("other", rounds_,
+        roundTicks_ > phaseTicks ? roundTicks_ - phaseTicks : 0, 0);
+    snprintf(line, sizeof line, "%-18s %16s %14s\n", "counter", "total",
+             "per round");
+    os << line;
+    for (unsigned c = 0; c < COUNTERS; c++) {
+        snprintf(line, sizeof line, "%-18s %16llu %14.1f\n",
+                 counterName(Counter(c)),
+                 static_cast<unsigned long long>(totals_[c]),
+                 rounds_ ? static_cast<double>(totals_[c]) / rounds_ : 0.0);
+        os << line;
+    }
+}
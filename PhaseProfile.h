@@ -0,0 +1,119 @@
+#ifndef PHASEPROFILE_H
+#define PHASEPROFILE_H
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include "OutputWriter.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#else
+#include <chrono>
+#endif
+
+// Per-phase timings and per-round counters of one game, for
+// `game --profile`. Phases are timed with the CPU's cycle counter; the
+// rate against the steady clock is measured once, when the profiler is
+// created, to report times. The summary only keeps totals, so its cost is
+// a few counter reads per round. With a trace fd every phase and every
+// round's counters are also streamed as Chrome trace events
+// (chrome://tracing, Perfetto).
+class PhaseProfiler {
+public:
+    enum Phase : uint8_t {
+        MOVE,        // moveKoopas
+        SPAWN,       // spawnKoopas
+        THROW,       // throwRocks
+        LIFETIMES,   // the median and percentile lines
+        STATS,       // printStats
+        CHECKPOINT,  // writeCheckpoint
+        PHASES
+    };
+
+    enum Counter : uint8_t {
+        MOVED,        // Koopas moved
+        HEAP_PUSHES,  // Koopas added to the target heap
+        HEAP_POPS,    // Koopas knocked out of it
+        KEY_UPDATES,  // damaged Koopas re-sifted in place
+        ROCKS,        // rocks thrown
+        COUNTERS
+    };
+
+    // traceFd < 0: summary only.
+    explicit PhaseProfiler(int traceFd = -1);
+    ~PhaseProfiler();
+
+    PhaseProfiler(const PhaseProfiler&) = delete;
+    PhaseProfiler &operator=(const PhaseProfiler&) = delete;
+
+    static uint64_t now() {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return static_cast<uint64_t>(
+            std::chrono::steady_clock::now().time_since_epoch().count());
+#endif
+    }
+
+    void beginRound(uint32_t round);
+    void phase(Phase p, uint64_t start, uint64_t end);
+    void count(Counter c, uint64_t n) { roundCounts_[c] += n; }
+    void endRound();
+
+    // Per-phase totals and counter totals as a table.
+    void printSummary(std::ostream &os) const;
+
+    static const char *phaseName(Phase p);
+    static const char *counterName(Counter c);
+
+private:
+    struct PhaseTotal {
+        uint64_t calls = 0;
+        uint64_t ticks = 0;
+        uint64_t maxTicks = 0;
+    };
+
+    double nsPerTick_;
+    uint64_t origin_;
+    uint32_t round_;
+    uint32_t rounds_;
+    uint64_t roundStart_;
+    uint64_t roundTicks_;
+    bool open_;
+    PhaseTotal phases_[PHASES];
+    uint64_t roundCounts_[COUNTERS];
+    uint64_t totals_[COUNTERS];
+
+    int traceFd_;
+    std::unique_ptr<OutputWriter> trace_;
+    bool firstEvent_;
+
+    void closeRound(uint64_t end);
+    uint64_t toNs(uint64_t ticks) const;
+    void beginEvent(const char *name, char type, uint64_t at);
+    void putMicros(uint64_t ns);
+};
+
+// Times the enclosing scope as one phase of `profiler`, if there is one.
+class PhaseScope {
+public:
+    PhaseScope(PhaseProfiler *profiler, PhaseProfiler::Phase phase)
+      : profiler_(profiler), phase_(phase),
+        start_(profiler ? PhaseProfiler::now() : 0) {}
+
+    ~PhaseScope() {
+        if (profiler_) profiler_->phase(phase_, start_, PhaseProfiler::now());
+    }
+
+    PhaseScope(const PhaseScope&) = delete;
+    PhaseScope &operator=(const PhaseScope&) = delete;
+
+private:
+    PhaseProfiler *profiler_;
+    PhaseProfiler::Phase phase_;
+    uint64_t start_;
+};
+
+#endif
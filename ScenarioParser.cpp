@@ -0,0 +1,174 @@
+// ScenarioParser.cpp   Zero-copy parser for the wave scenario format.
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <cstdlib>
+#include <cstring>
+#include <cerrno>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ScenarioParser.h"
+
+namespace {
+
+// The characters std::istream treats as whitespace in the C locale.
+bool isSpace(char c) {
+    return c == ' ' || c == '\t' || c == '\n' ||
+           c == '\v' || c == '\f' || c == '\r';
+}
+
+const char *skipSpace(const char *p, const char *end) {
+    while (p != end && isSpace(*p)) p++;
+    return p;
+}
+
+const char *skipToken(const char *p, const char *end) {
+    while (p != end && !isSpace(*p)) p++;
+    return p;
+}
+
+}
+
+InputBuffer::InputBuffer(int fd) : data_(nullptr), size_(0), mapped_(false) {
+    struct stat st;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode) && st.st_size > 0) {
+        size_t len = static_cast<size_t>(st.st_size);
+        void *p = mmap(nullptr, len, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (p != MAP_FAILED) {
+            madvise(p, len, MADV_SEQUENTIAL);
+            data_ = static_cast<const char*>(p);
+            size_ = len;
+            mapped_ = true;
+            return;
+        }
+    }
+
+    const size_t BLOCK = 1 << 20;
+    size_t cap = BLOCK;
+    char *buf = static_cast<char*>(std::malloc(cap));
+    size_t len = 0;
+    while (buf) {
+        if (cap - len < BLOCK) {
+            cap *= 2;
+            char *grown = static_cast<char*>(std::realloc(buf, cap));
+            if (!grown) break;
+            buf = grown;
+        }
+        ssize_t got = read(fd, buf + len, cap - len);
+        if (got < 0 && errno == EINTR) continue;
+        if (got < 0) {
+            std::cerr << "Error reading input: " << std::strerror(errno) << "\n";
+            std::exit(1);
+        }
+        if (got == 0) {
+            data_ = buf;
+            size_ = len;
+            return;
+        }
+        len += static_cast<size_t>(got);
+    }
+    std::cerr << "Out of memory reading input\n";
+    std::exit(1);
+}
+
+InputBuffer::~InputBuffer() {
+    if (mapped_) {
+        munmap(const_cast<char*>(data_), size_);
+    } else {
+        std::free(const_cast<char*>(data_));
+    }
+}
+
+ScenarioParser::ScenarioParser(const char *begin, const char *end)
+  : begin_(begin), cur_(begin), end_(end), block_(begin) {}
+
+bool ScenarioParser::readLine(std::string_view &line) {
+    if (cur_ == end_) return false;
+    const void *nl = std::memchr(cur_, '\n', static_cast<size_t>(end_ - cur_));
+    const char *stop = nl ? static_cast<const char*>(nl) : end_;
+    line = std::string_view(cur_, static_cast<size_t>(stop - cur_));
+    cur_ = nl ? stop + 1 : end_;
+    return true;
+}
+
+void ScenarioParser::skipLine() {
+    std::string_view ignored;
+    readLine(ignored);
+}
+
+std::string_view ScenarioParser::readToken() {
+    cur_ = skipSpace(cur_, end_);
+    const char *start = cur_;
+    cur_ = skipToken(cur_, end_);
+    return std::string_view(start, static_cast<size_t>(cur_ - start));
+}
+
+bool ScenarioParser::readUint(uint32_t &val) {
+    cur_ = skipSpace(cur_, end_);
+    auto res = std::from_chars(cur_, end_, val);
+    if (res.ec != std::errc()) return false;
+    cur_ = res.ptr;
+    return true;
+}
+
+ScenarioHeader ScenarioParser::readHeader() {
+    ScenarioHeader h;
+    skipLine();
+    uint32_t *fields[] = { &h.bagCapacity, &h.seed, &h.maxDistance,
+                           &h.maxSpeed, &h.maxHealth };
+    for (uint32_t *f : fields) {
+        readToken();
+        if (!readUint(*f)) break;
+    }
+    return h;
+}
+
+bool ScenarioParser::nextWave(RoundConfig &rc) {
+    std::string_view line;
+    while (readLine(line)) {
+        if (line.empty() || line[0] != '-') continue;
+        block_ = line.data();
+        rc = RoundConfig();
+        readToken();
+        readUint(rc.waveNumber);
+        readToken();
+        readUint(rc.randomKoopas);
+        readToken();
+        readUint(rc.namedKoopas);
+        skipLine();
+        // The count comes from the input, so a corrupt one must not size
+        // the allocation: no Koopa line is shorter than 4 bytes.
+        size_t fits = static_cast<size_t>(end_ - cur_) / 4;
+        rc.koopas.reserve(std::min<size_t>(rc.namedKoopas, fits));
+        for (uint32_t i = 0; i < rc.namedKoopas; i++) {
+            if (!readLine(line)) break;
+            rc.koopas.push_back(parseNamedKoopa(line));
+        }
+        return true;
+    }
+    return false;
+}
+
+NamedKoopa ScenarioParser::parseNamedKoopa(std::string_view line) {
+    NamedKoopa k;
+    const char *p = line.data();
+    const char *end = p + line.size();
+    p = skipSpace(p, end);
+    const char *nameEnd = skipToken(p, end);
+    k.name = std::string_view(p, static_cast<size_t>(nameEnd - p));
+    p = nameEnd;
+    uint32_t *fields[] = { &k.distance, &k.speed, &k.health };
+    for (uint32_t *f : fields) {
+        p = skipToken(skipSpace(p, end), end);
+        p = skipSpace(p, end);
+        auto res = std::from_chars(p, end, *f);
+        if (res.ec != std::errc()) {
+            *f = 0;
+            break;
+        }
+        p = res.ptr;
+    }
+    return k;
+}
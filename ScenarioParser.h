@@ -0,0 +1,100 @@
+#ifndef SCENARIOPARSER_H
+#define SCENARIOPARSER_H
+
+#include <string_view>
+#include <vector>
+#include <cstddef>
+#include <cstdint>
+
+struct ScenarioHeader {
+    uint32_t bagCapacity = 0;
+    uint32_t seed = 0;
+    uint32_t maxDistance = 0;
+    uint32_t maxSpeed = 0;
+    uint32_t maxHealth = 0;
+};
+
+// One named-Koopa line of a wave block. The name is a view into the input
+// buffer, which must outlive it.
+struct NamedKoopa {
+    std::string_view name;
+    uint32_t distance = 0;
+    uint32_t speed = 0;
+    uint32_t health = 0;
+};
+
+struct RoundConfig {
+    uint32_t waveNumber = 0;
+    uint32_t randomKoopas = 0;
+    uint32_t namedKoopas = 0;
+    std::vector<NamedKoopa> koopas;
+};
+
+// The whole scenario input in memory. A regular file is mapped read-only;
+// anything else (a pipe, a terminal) is read in large blocks into one
+// buffer.
+class InputBuffer {
+public:
+    explicit InputBuffer(int fd);
+    ~InputBuffer();
+
+    InputBuffer(const InputBuffer&) = delete;
+    InputBuffer &operator=(const InputBuffer&) = delete;
+
+    const char *begin() const { return data_; }
+    const char *end() const { return data_ + size_; }
+
+private:
+    const char *data_;
+    size_t size_;
+    bool mapped_;
+};
+
+// Parses the scenario format in place:
+//
+//   <comment line>
+//   Bag-Capacity: N
+//   Seed: N
+//   Max-Rand-Distance: N
+//   Max-Rand-Speed: N
+//   Max-Rand-Health: N
+//   ---
+//   wave: N
+//   random-koopas: N
+//   named-koopas: K
+//   <name> distance: N speed: N health: N      (K lines)
+//   ---
+//   ...
+//
+// Labels are skipped without being checked, lines that are neither a wave
+// block nor part of one are ignored, and integers go through from_chars.
+class ScenarioParser {
+public:
+    ScenarioParser(const char *begin, const char *end);
+
+    ScenarioHeader readHeader();
+
+    // Reads the next wave block in file order. Returns false at the end of
+    // the input.
+    bool nextWave(RoundConfig &rc);
+
+    // Offset of the parse cursor from the start of the input.
+    size_t offset() const { return static_cast<size_t>(cur_ - begin_); }
+
+    // Offset of the "---" line that began the block nextWave() read last.
+    size_t blockOffset() const { return static_cast<size_t>(block_ - begin_); }
+
+private:
+    const char *begin_;
+    const char *cur_;
+    const char *end_;
+    const char *block_;
+
+    bool readLine(std::string_view &line);
+    std::string_view readToken();
+    bool readUint(uint32_t &val);
+    void skipLine();
+    static NamedKoopa parseNamedKoopa(std::string_view line);
+};
+
+#endif
@@ -0,0 +1,46 @@
+#ifndef SPSCQUEUE_H
+#define SPSCQUEUE_H
+
+#include <atomic>
+#include <cstddef>
+#include <vector>
+
+// Bounded lock-free queue for exactly one producer thread and one consumer
+// thread. Each side owns one index and only reads the other's, so a push
+// or pop is a load, a slot copy and a release store.
+template <typename T>
+class SpscQueue {
+public:
+    explicit SpscQueue(size_t capacity)
+      : slots_(capacity + 1), head_(0), tail_(0) {}
+
+    SpscQueue(const SpscQueue&) = delete;
+    SpscQueue &operator=(const SpscQueue&) = delete;
+
+    // Producer side. False if the queue is full.
+    bool tryPush(const T &v) {
+        size_t tail = tail_.load(std::memory_order_relaxed);
+        size_t next = tail + 1 == slots_.size() ? 0 : tail + 1;
+        if (next == head_.load(std::memory_order_acquire)) return false;
+        slots_[tail] = v;
+        tail_.store(next, std::memory_order_release);
+        return true;
+    }
+
+    // Consumer side. False if the queue is empty.
+    bool tryPop(T &v) {
+        size_t head = head_.load(std::memory_order_relaxed);
+        if (head == tail_.load(std::memory_order_acquire)) return false;
+        v = slots_[head];
+        head_.store(head + 1 == slots_.size() ? 0 : head + 1,
+                    std::memory_order_release);
+        return true;
+    }
+
+private:
+    std::vector<T> slots_;
+    alignas(64) std::atomic<size_t> head_;   // next slot to pop
+    alignas(64) std::atomic<size_t> tail_;   // next slot to push
+};
+
+#endif
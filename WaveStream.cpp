@@ -0,0 +1,395 @@
+// WaveStream.cpp   Wave blocks read as the game reaches them (--stream-waves).
+
+#include <algorithm>
+#include <cerrno>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <iostream>
+#include <numeric>
+#include <poll.h>
+#include <string>
+#include <sys/stat.h>
+#include <unistd.h>
+#include "ByteIo.h"
+#include "WaveStream.h"
+
+namespace {
+
+// Waiting on an SpscQueue: yield at first, then sleep in short steps so an
+// idle side does not hold a core.
+class Backoff {
+public:
+    void pause() {
+        if (spins_ < 64) {
+            spins_++;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+private:
+    unsigned spins_ = 0;
+};
+
+// Streams waves in file order and insists that they are sorted.
+class StreamedWaves : public WaveSource {
+public:
+    explicit StreamedWaves(int fd) : stream_(fd), last_(0) {}
+
+    ScenarioHeader readHeader() { return stream_.readHeader(); }
+
+    const RoundConfig *next() override {
+        const RoundConfig *rc = stream_.nextWave();
+        if (rc && rc->waveNumber < last_) {
+            throw WaveOrderError("Wave " + std::to_string(rc->waveNumber) +
+                                 " comes after wave " + std::to_string(last_) +
+                                 "; --stream-waves needs a piped scenario"
+                                 " sorted by wave number");
+        }
+        if (rc) last_ = rc->waveNumber;
+        return rc;
+    }
+
+    void stopOn(const std::atomic<bool> *stop) override {
+        stream_.stopOn(stop);
+    }
+
+private:
+    ScenarioStream stream_;
+    uint32_t last_;
+};
+
+// External sort of an unsorted scenario. The blocks are read in runs of up
+// to RUN_BYTES of text; each run is sorted by wave number in memory and
+// written to an unlinked temporary file. next() merges the runs, reading
+// each one a small chunk at a time.
+class SpilledWaves : public WaveSource {
+public:
+    static const size_t RUN_BYTES = 64 << 20;
+    static const size_t RUN_CHUNK = 1 << 16;
+
+    // Takes the waves that `input` has not returned yet.
+    explicit SpilledWaves(ScenarioStream &input) {
+        std::string text;
+        std::vector<Block> blocks;
+        while (const RoundConfig *rc = input.nextWave()) {
+            std::string_view t = input.waveText();
+            size_t offset = text.size();
+            text.append(t.data(), t.size());
+            if (text.empty() || text.back() != '\n') text.push_back('\n');
+            blocks.push_back({ rc->waveNumber, offset, text.size() - offset });
+            if (text.size() >= RUN_BYTES) writeRun(blocks, text);
+        }
+        if (!blocks.empty()) writeRun(blocks, text);
+        for (Run &r : runs_) r.wave = r.stream->nextWave();
+        last_ = runs_.size();
+    }
+
+    ~SpilledWaves() override {
+        for (Run &r : runs_) close(r.fd);
+    }
+
+    // Smallest wave number first; between runs, ties go to the earlier
+    // run, which came earlier in the file.
+    const RoundConfig *next() override {
+        if (last_ < runs_.size()) {
+            runs_[last_].wave = runs_[last_].stream->nextWave();
+        }
+        last_ = runs_.size();
+        for (size_t i = 0; i < runs_.size(); i++) {
+            const RoundConfig *w = runs_[i].wave;
+            if (w && (last_ == runs_.size() ||
+                      w->waveNumber < runs_[last_].wave->waveNumber)) {
+                last_ = i;
+            }
+        }
+        return last_ < runs_.size() ? runs_[last_].wave : nullptr;
+    }
+
+private:
+    struct Block {
+        uint32_t wave;
+        size_t   offset;
+        size_t   length;
+    };
+
+    struct Run {
+        int fd;
+        std::unique_ptr<ScenarioStream> stream;
+        const RoundConfig *wave;
+    };
+
+    std::vector<Run> runs_;
+    size_t last_;   // run of the wave next() returned last
+
+    void writeRun(std::vector<Block> &blocks, std::string &text) {
+        const char *dir = std::getenv("TMPDIR");
+        std::string path = std::string(dir && *dir ? dir : "/tmp") +
+                           "/mario_defense_waves.XXXXXX";
+        int fd = mkstemp(&path[0]);
+        if (fd < 0) ByteIo::ioError("Cannot create temporary file", path);
+        unlink(path.c_str());
+
+        std::stable_sort(blocks.begin(), blocks.end(),
+                         [](const Block &a, const Block &b) {
+                             return a.wave < b.wave;
+                         });
+        std::string out;
+        for (const Block &b : blocks) {
+            out.append(text, b.offset, b.length);
+            if (out.size() >= RUN_CHUNK * 16 || &b == &blocks.back()) {
+                if (!ByteIo::writeAll(fd, out.data(), out.size())) {
+                    ByteIo::ioError("Cannot write temporary file", path);
+                }
+                out.clear();
+            }
+        }
+        if (lseek(fd, 0, SEEK_SET) != 0) ByteIo::ioError("Cannot rewind", path);
+        runs_.push_back({ fd, std::unique_ptr<ScenarioStream>(
+                                  new ScenarioStream(fd, RUN_CHUNK)),
+                          nullptr });
+        blocks.clear();
+        text.clear();
+    }
+};
+
+}
+
+ScenarioStream::ScenarioStream(int fd, size_t chunk)
+  : fd_(fd), chunk_(chunk), start_(0), end_(0), eof_(false),
+    stop_(nullptr) {}
+
+// Waits in short polls so the stop flag is seen while the input stalls.
+void ScenarioStream::waitForInput() {
+    const int POLL_MS = 10;
+    struct pollfd p = { fd_, POLLIN, 0 };
+    while (!stop_->load(std::memory_order_relaxed)) {
+        int n = poll(&p, 1, POLL_MS);
+        // Ready, or an error that read() will report.
+        if (n > 0 || (n < 0 && errno != EINTR)) return;
+    }
+    throw ReadStopped("Stopped reading the scenario");
+}
+
+// Moves the unparsed bytes to the front and reads more after them: at least
+// as many as are already held once that passes a chunk, so a block that
+// needs several reads is parsed again only a logarithmic number of times.
+// False at the end of the input.
+bool ScenarioStream::fill() {
+    if (eof_) return false;
+    if (start_ > 0) {
+        std::memmove(buf_.data(), buf_.data() + start_, end_ - start_);
+        end_ -= start_;
+        start_ = 0;
+    }
+    size_t need = end_ >= chunk_ ? end_ : 1;
+    if (buf_.size() < end_ + std::max(chunk_, need)) {
+        buf_.resize(end_ + std::max(chunk_, need));
+    }
+    size_t got = 0;
+    while (got < need) {
+        if (stop_) waitForInput();
+        ssize_t n = read(fd_, buf_.data() + end_, buf_.size() - end_);
+        if (n < 0 && errno == EINTR) continue;
+        if (n < 0) {
+            std::cerr << "Error reading input: " << std::strerror(errno) << "\n";
+            std::exit(1);
+        }
+        if (n == 0) {
+            eof_ = true;
+            break;
+        }
+        end_ += static_cast<size_t>(n);
+        got += static_cast<size_t>(n);
+    }
+    return got > 0;
+}
+
+// A parse that stops at the end of the bytes read may have been cut short,
+// so unless the input is exhausted it is redone after reading more.
+ScenarioHeader ScenarioStream::readHeader() {
+    for (;;) {
+        ScenarioParser p(buf_.data() + start_, buf_.data() + end_);
+        ScenarioHeader h = p.readHeader();
+        if (p.offset() < end_ - start_ || eof_) {
+            start_ += p.offset();
+            return h;
+        }
+        fill();
+    }
+}
+
+const RoundConfig *ScenarioStream::nextWave() {
+    for (;;) {
+        size_t held = end_ - start_;
+        ScenarioParser p(buf_.data() + start_, buf_.data() + end_);
+        bool found = p.nextWave(wave_);
+        if (found && (p.offset() < held || eof_)) {
+            text_ = std::string_view(buf_.data() + start_ + p.blockOffset(),
+                                     p.offset() - p.blockOffset());
+            start_ += p.offset();
+            return &wave_;
+        }
+        if (!found) {
+            if (eof_) {
+                start_ = end_;
+                text_ = std::string_view();
+                return nullptr;
+            }
+            // No block starts in what was read; keep only the last,
+            // unfinished line.
+            const void *nl = memrchr(buf_.data() + start_, '\n', held);
+            if (nl) start_ = static_cast<size_t>(
+                static_cast<const char*>(nl) - buf_.data()) + 1;
+        }
+        fill();
+    }
+}
+
+std::unique_ptr<WaveSource> openWaveStream(int fd, ScenarioHeader &header) {
+    struct stat st;
+    off_t origin = -1;
+    if (fstat(fd, &st) == 0 && S_ISREG(st.st_mode)) {
+        origin = lseek(fd, 0, SEEK_CUR);
+    }
+    if (origin < 0) {
+        std::unique_ptr<StreamedWaves> waves(new StreamedWaves(fd));
+        header = waves->readHeader();
+        return std::unique_ptr<WaveSource>(waves.release());
+    }
+
+    bool sorted = true;
+    {
+        ScenarioStream scan(fd);
+        header = scan.readHeader();
+        uint32_t last = 0;
+        while (const RoundConfig *rc = scan.nextWave()) {
+            if (rc->waveNumber < last) {
+                sorted = false;
+                break;
+            }
+            last = rc->waveNumber;
+        }
+    }
+    if (lseek(fd, origin, SEEK_SET) != origin) ByteIo::ioError("Cannot rewind", "input");
+    if (sorted) {
+        std::unique_ptr<StreamedWaves> waves(new StreamedWaves(fd));
+        waves->readHeader();
+        return std::unique_ptr<WaveSource>(waves.release());
+    }
+    ScenarioStream input(fd);
+    input.readHeader();
+    return std::unique_ptr<WaveSource>(new SpilledWaves(input));
+}
+
+struct ParseAheadWaves::Batch {
+    RoundConfig wave;
+    std::string names;          // the named Koopas' names, wave views them
+    DrawnWave drawn;
+    bool end = false;           // no more waves (or the producer failed)
+    std::exception_ptr error;
+};
+
+ParseAheadWaves::ParseAheadWaves(std::unique_ptr<WaveSource> source,
+                                 const ScenarioHeader &header,
+                                 unsigned threads)
+  : source_(std::move(source)), threads_(threads),
+    ready_(DEPTH + 1), spent_(DEPTH + 1), stop_(false), current_(nullptr) {
+    rng_.initialize(header.seed, header.maxDistance, header.maxSpeed,
+                    header.maxHealth);
+    for (size_t i = 0; i < DEPTH + 1; i++) {
+        batches_.emplace_back(new Batch());
+        spent_.tryPush(batches_.back().get());
+    }
+    source_->stopOn(&stop_);
+    producer_ = std::thread(&ParseAheadWaves::produce, this);
+}
+
+ParseAheadWaves::~ParseAheadWaves() {
+    stop_.store(true, std::memory_order_relaxed);
+    producer_.join();
+}
+
+// Both queues can hold every batch, so pushes never fail.
+void ParseAheadWaves::produce() {
+    for (;;) {
+        Batch *b;
+        Backoff wait;
+        while (!spent_.tryPop(b)) {
+            if (stop_.load(std::memory_order_relaxed)) return;
+            wait.pause();
+        }
+        if (stop_.load(std::memory_order_relaxed)) return;
+        try {
+            const RoundConfig *rc = source_->next();
+            if (rc) {
+                fill(*b, *rc);
+            } else {
+                b->end = true;
+            }
+        } catch (...) {
+            b->error = std::current_exception();
+            b->end = true;
+        }
+        ready_.tryPush(b);
+        if (b->end) return;
+    }
+}
+
+void ParseAheadWaves::fill(Batch &b, const RoundConfig &rc) {
+    b.wave.waveNumber = rc.waveNumber;
+    b.wave.randomKoopas = rc.randomKoopas;
+    b.wave.namedKoopas = rc.namedKoopas;
+    b.wave.koopas.assign(rc.koopas.begin(), rc.koopas.end());
+    size_t bytes = 0;
+    for (const NamedKoopa &k : rc.koopas) bytes += k.name.size();
+    b.names.clear();
+    b.names.reserve(bytes);     // no reallocation below, so views hold
+    for (NamedKoopa &k : b.wave.koopas) {
+        size_t at = b.names.size();
+        b.names.append(k.name.data(), k.name.size());
+        k.name = std::string_view(b.names.data() + at, k.name.size());
+    }
+
+    DrawnWave &d = b.drawn;
+    size_t n = rc.randomKoopas;
+    d.distance.resize(n);
+    d.speed.resize(n);
+    d.health.resize(n);
+    d.first = rng_.generateKoopas(n, d.distance.data(), d.speed.data(),
+                                  d.health.data(), threads_);
+    d.nameKeys.resize(n);
+    for (uint32_t i = 0; i < n; i++) {
+        d.nameKeys[i] = KoopaRandomGenerator::koopaNameKey(d.first + i);
+    }
+    std::sort(d.nameKeys.begin(), d.nameKeys.end());
+
+    const std::vector<NamedKoopa> &named = b.wave.koopas;
+    d.namedByName.resize(named.size());
+    std::iota(d.namedByName.begin(), d.namedByName.end(), 0u);
+    std::stable_sort(d.namedByName.begin(), d.namedByName.end(),
+                     [&named](uint32_t x, uint32_t y) {
+                         return named[x].name < named[y].name;
+                     });
+}
+
+const RoundConfig *ParseAheadWaves::next() {
+    if (current_) {
+        if (current_->end) return nullptr;
+        spent_.tryPush(current_);
+        current_ = nullptr;
+    }
+    Batch *b;
+    Backoff wait;
+    while (!ready_.tryPop(b)) wait.pause();
+    current_ = b;
+    if (b->error) std::rethrow_exception(b->error);
+    return b->end ? nullptr : &b->wave;
+}
+
+const DrawnWave *ParseAheadWaves::drawn() const {
+    return current_ && !current_->end ? &current_->drawn : nullptr;
+}
@@ -0,0 +1,163 @@
+#ifndef WAVESTREAM_H
+#define WAVESTREAM_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <stdexcept>
+#include <string_view>
+#include <thread>
+#include <vector>
+#include "KoopaRandomGenerator.h"
+#include "ScenarioParser.h"
+#include "SpscQueue.h"
+
+// Thrown when a piped scenario read with --stream-waves is not sorted by
+// wave number.
+class WaveOrderError : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// Thrown by a read that gave up because its stop flag was set (see
+// WaveSource::stopOn()).
+class ReadStopped : public std::runtime_error {
+public:
+    using std::runtime_error::runtime_error;
+};
+
+// A wave's random Koopas drawn ahead of spawning (see ParseAheadWaves).
+// Random Koopa i is named koopaName(first + i); nameKeys are their
+// koopaNameKey()s in ascending order, and namedByName lists the wave's
+// named Koopas by name, equal names in file order.
+struct DrawnWave {
+    uint32_t first = 0;
+    std::vector<uint32_t> distance;
+    std::vector<uint32_t> speed;
+    std::vector<uint32_t> health;
+    std::vector<uint64_t> nameKeys;
+    std::vector<uint32_t> namedByName;
+};
+
+// The wave blocks of a game in the order they spawn.
+class WaveSource {
+public:
+    virtual ~WaveSource() {}
+
+    // The next wave, or nullptr when there are no more. The block, and the
+    // Koopa names in it, stay valid until the next call.
+    virtual const RoundConfig *next() = 0;
+
+    // The random Koopas of the wave next() returned last, or nullptr if
+    // the game draws them itself.
+    virtual const DrawnWave *drawn() const { return nullptr; }
+
+    // From now on a read that has to wait for input checks *stop every
+    // few milliseconds and throws ReadStopped once it is set. Sources
+    // that never wait ignore it.
+    virtual void stopOn(const std::atomic<bool> *) {}
+};
+
+// Waves already in memory and sorted, as readWaves() leaves them. Only
+// reads them, so many games can share one vector.
+class WaveList : public WaveSource {
+public:
+    explicit WaveList(const std::vector<RoundConfig> &waves)
+      : waves_(waves), index_(0) {}
+
+    const RoundConfig *next() override {
+        return index_ < waves_.size() ? &waves_[index_++] : nullptr;
+    }
+
+private:
+    const std::vector<RoundConfig> &waves_;
+    size_t index_;
+};
+
+// Reads a scenario from a file descriptor a chunk at a time and parses it
+// with ScenarioParser. Only the unparsed input and the current block are
+// held, so memory is bounded by the largest wave block, not the file.
+class ScenarioStream {
+public:
+    explicit ScenarioStream(int fd, size_t chunk = 1 << 20);
+
+    ScenarioStream(const ScenarioStream&) = delete;
+    ScenarioStream &operator=(const ScenarioStream&) = delete;
+
+    ScenarioHeader readHeader();
+
+    // The next wave block in file order, or nullptr at the end of the
+    // input. Valid until the next call.
+    const RoundConfig *nextWave();
+
+    // The text of that block, from its "---" line to its last Koopa line.
+    std::string_view waveText() const { return text_; }
+
+    // See WaveSource::stopOn().
+    void stopOn(const std::atomic<bool> *stop) { stop_ = stop; }
+
+private:
+    int fd_;
+    size_t chunk_;
+    std::vector<char> buf_;
+    size_t start_;        // first byte not parsed yet
+    size_t end_;          // end of the bytes read
+    bool eof_;
+    RoundConfig wave_;
+    std::string_view text_;
+    const std::atomic<bool> *stop_;
+
+    bool fill();
+    void waitForInput();
+};
+
+// Runs `source` on a producer thread a few waves ahead of the game: each
+// block is copied out with its names, its random Koopas are drawn from a
+// generator of its own (on up to `threads` threads) and its names are put
+// in rank order, so spawning only has to take the finished batch. Batches
+// go to the game through one SpscQueue and come back for reuse through
+// another. Errors on the producer are rethrown by next(). Destroying this
+// sets a stop flag and joins the producer. The flag is passed to the
+// source with stopOn(), so a producer blocked reading a stalled pipe gives
+// up within a few milliseconds; one drawing Koopas finishes that wave.
+class ParseAheadWaves : public WaveSource {
+public:
+    static const size_t DEPTH = 4;   // batches ready ahead of the game
+
+    ParseAheadWaves(std::unique_ptr<WaveSource> source,
+                    const ScenarioHeader &header, unsigned threads);
+    ~ParseAheadWaves() override;
+
+    ParseAheadWaves(const ParseAheadWaves&) = delete;
+    ParseAheadWaves &operator=(const ParseAheadWaves&) = delete;
+
+    const RoundConfig *next() override;
+    const DrawnWave *drawn() const override;
+
+private:
+    struct Batch;
+
+    std::unique_ptr<WaveSource> source_;
+    KoopaRandomGenerator rng_;
+    unsigned threads_;
+    std::vector<std::unique_ptr<Batch>> batches_;
+    SpscQueue<Batch*> ready_;    // producer to game
+    SpscQueue<Batch*> spent_;    // game back to producer
+    std::atomic<bool> stop_;
+    std::thread producer_;
+    Batch *current_;
+
+    void produce();
+    void fill(Batch &b, const RoundConfig &rc);
+};
+
+// Waves of the scenario on `fd` for --stream-waves, with its header read
+// into `header`. A pipe is played as it is read and must already be sorted
+// by wave number; a wave out of order throws WaveOrderError when it is
+// reached. A regular file is scanned first: if it is sorted it is then
+// streamed, otherwise its blocks are sorted through temporary files.
+// Waves with the same number keep their file order.
+std::unique_ptr<WaveSource> openWaveStream(int fd, ScenarioHeader &header);
+
+#endif
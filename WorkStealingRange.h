@@ -0,0 +1,105 @@
+#ifndef WORKSTEALINGRANGE_H
+#define WORKSTEALINGRANGE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <exception>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+// Hands out the integers of [begin, end) to a fixed set of workers. Each
+// worker starts with an equal contiguous share and takes items from its
+// front; a worker that runs dry steals the back half of another worker's
+// share. Every item is claimed exactly once, and a worker only touches
+// another's lock when it has nothing left of its own.
+class WorkStealingRange {
+public:
+    WorkStealingRange(uint64_t begin, uint64_t end, unsigned workers)
+      : count_(workers == 0 ? 1 : workers), shares_(new Share[count_]) {
+        uint64_t total = end > begin ? end - begin : 0;
+        for (unsigned w = 0; w < count_; w++) {
+            shares_[w].next = begin + total * w / count_;
+            shares_[w].end = begin + total * (w + 1) / count_;
+        }
+    }
+
+    unsigned workers() const { return count_; }
+
+    // Claims the next item for `worker`; false once all work is claimed.
+    bool next(unsigned worker, uint64_t &item) {
+        Share &own = shares_[worker];
+        {
+            std::lock_guard<std::mutex> g(own.lock);
+            if (own.next < own.end) {
+                item = own.next++;
+                return true;
+            }
+        }
+        for (unsigned i = 1; i < count_; i++) {
+            Share &victim = shares_[(worker + i) % count_];
+            uint64_t from, to;
+            {
+                std::lock_guard<std::mutex> g(victim.lock);
+                if (victim.next >= victim.end) continue;
+                to = victim.end;
+                from = victim.next + (victim.end - victim.next) / 2;
+                victim.end = from;
+            }
+            std::lock_guard<std::mutex> g(own.lock);
+            own.next = from + 1;
+            own.end = to;
+            item = from;
+            return true;
+        }
+        return false;
+    }
+
+private:
+    struct alignas(64) Share {
+        std::mutex lock;
+        uint64_t next = 0;
+        uint64_t end = 0;
+    };
+
+    unsigned count_;
+    std::unique_ptr<Share[]> shares_;
+};
+
+// Calls fn(worker, item) for every item of [begin, end) on `threads`
+// threads, the calling thread included. worker is in [0, threads), so fn
+// can keep per-thread state without locking. The first exception thrown
+// by fn stops the remaining work and is rethrown here.
+template <typename Fn>
+void parallelFor(uint64_t begin, uint64_t end, unsigned threads, Fn fn) {
+    WorkStealingRange range(begin, end, threads);
+    std::atomic<bool> failed(false);
+    std::exception_ptr error;
+    std::mutex errorLock;
+
+    auto work = [&](unsigned worker) {
+        uint64_t item;
+        while (!failed.load(std::memory_order_relaxed) &&
+               range.next(worker, item)) {
+            try {
+                fn(worker, item);
+            } catch (...) {
+                std::lock_guard<std::mutex> g(errorLock);
+                if (!error) error = std::current_exception();
+                failed = true;
+            }
+        }
+    };
+
+    std::vector<std::thread> pool;
+    for (unsigned w = 1; w < range.workers(); w++) {
+        pool.emplace_back(work, w);
+    }
+    work(0);
+    for (std::thread &t : pool) t.join();
+    if (error) std::rethrow_exception(error);
+}
+
+#endif
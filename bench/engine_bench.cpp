@@ -0,0 +1,272 @@
+// engine_bench.cpp   Timings of the engine's hot paths as JSON: moving
+// Koopas, spawning, throwing rocks, the targeting heap, the lifetime
+// tracker, printStats, random draws and wave parsing, each at 10^2 to 10^7
+// Koopas. The round phases are timed both in the quiet engine and, marked
+// "(dynamic)", in the one that checks its features at run time with all of
+// them off, which is what the quiet engine saves.
+//
+// The engine is compiled in from game.cpp without its main, and
+// EngineBench reaches the round phases as a friend of MarioCastleDefense.
+// Usage: engine_bench [--max-size N] [--min-time SECONDS]
+
+#define MARIO_DEFENSE_NO_MAIN
+#include "../game.cpp"
+#include "../MersenneTwistKernel.h"
+
+#include <chrono>
+#include <cstdio>
+
+namespace {
+
+// Results that must not be optimized away are added here.
+volatile uint64_t sink;
+
+struct Measurement {
+    const char *kernel;
+    size_t   n;
+    uint64_t reps;
+    double   nsPerItem;
+    double   itemsPerSecond;
+};
+
+// Runs setup() untimed and then run() timed until run() has taken at least
+// minSeconds in total (or the setups alone have taken 20 times that). Each
+// run() handles `items` items.
+template <typename Setup, typename Run>
+Measurement measure(const char *kernel, size_t n, size_t items,
+                    double minSeconds, Setup setup, Run run) {
+    typedef chrono::steady_clock Clock;
+    Clock::time_point begin = Clock::now();
+    chrono::duration<double> timed(0);
+    uint64_t reps = 0;
+    do {
+        setup();
+        Clock::time_point start = Clock::now();
+        run();
+        timed += Clock::now() - start;
+        reps++;
+    } while (timed.count() < minSeconds &&
+             chrono::duration<double>(Clock::now() - begin).count() <
+                 20 * minSeconds);
+    double total = static_cast<double>(items) * static_cast<double>(reps);
+    return { kernel, n, reps, timed.count() * 1e9 / total,
+             total / timed.count() };
+}
+
+}
+
+class EngineBench {
+public:
+    EngineBench(size_t maxSize, double minSeconds)
+      : maxSize(maxSize), minSeconds(minSeconds) {}
+
+    void runAll() {
+        for (size_t n = 100; n <= maxSize; n *= 10) {
+            moveKoopas<QuietFeatures>("moveKoopas", n);
+            moveKoopas<DynamicFeatures>("moveKoopas (dynamic)", n);
+            spawnKoopas<QuietFeatures>("spawnKoopas", n);
+            spawnKoopas<DynamicFeatures>("spawnKoopas (dynamic)", n);
+            throwRocks<QuietFeatures>("throwRocks", n);
+            throwRocks<DynamicFeatures>("throwRocks (dynamic)", n);
+            heap(n);
+            medianTracker(n);
+            printStats(n);
+            randomDraws(n);
+            parser(n);
+        }
+    }
+
+    void printJson() const {
+        printf("{\n  \"paths\": {\"move\": \"%s\", \"twist\": \"%s\"},\n",
+               KoopaMoveKernel::pathName(), MersenneTwistKernel::pathName());
+        printf("  \"results\": [\n");
+        for (size_t i = 0; i < results.size(); i++) {
+            const Measurement &m = results[i];
+            printf("    {\"kernel\": \"%s\", \"n\": %zu, \"reps\": %llu,"
+                   " \"ns_per_op\": %.3f, \"items_per_sec\": %.4g}%s\n",
+                   m.kernel, m.n, static_cast<unsigned long long>(m.reps),
+                   m.nsPerItem, m.itemsPerSecond,
+                   i + 1 < results.size() ? "," : "");
+        }
+        printf("  ]\n}\n");
+    }
+
+private:
+    size_t maxSize;
+    double minSeconds;
+    vector<Measurement> results;
+
+    // A game in round 1 and nothing printed.
+    template <typename Features>
+    static unique_ptr<MarioCastleDefense<Features>> newGame(uint32_t stats) {
+        unique_ptr<MarioCastleDefense<Features>> g(
+            new MarioCastleDefense<Features>(false, false, stats,
+                                             vector<Percentile>(), -1));
+        g->rng.initialize(7, 100000, 100, 50);
+        g->currentRound = 1;
+        return g;
+    }
+
+    // The same with n random Koopas just spawned. With `farAway` no Koopa
+    // can reach the castle for millions of moves.
+    template <typename Features>
+    static unique_ptr<MarioCastleDefense<Features>> spawned(size_t n,
+                                                            uint32_t stats,
+                                                            bool farAway) {
+        unique_ptr<MarioCastleDefense<Features>> g = newGame<Features>(stats);
+        g->spawnKoopas(static_cast<uint32_t>(n), vector<NamedKoopa>());
+        if (farAway) {
+            for (uint32_t &d : g->active.distance) d += 1u << 30;
+        }
+        return g;
+    }
+
+    template <typename Features>
+    void moveKoopas(const char *kernel, size_t n) {
+        unique_ptr<MarioCastleDefense<Features>> g =
+            spawned<Features>(n, 0, true);
+        results.push_back(measure(kernel, n, n, minSeconds, [](){},
+            [&]() {
+                g->currentRound++;
+                g->moveKoopas();
+            }));
+    }
+
+    // One wave of n random Koopas into an empty game.
+    template <typename Features>
+    void spawnKoopas(const char *kernel, size_t n) {
+        unique_ptr<MarioCastleDefense<Features>> g;
+        vector<NamedKoopa> none;
+        results.push_back(measure(kernel, n, n, minSeconds,
+            [&]() {
+                g.reset();
+                g = newGame<Features>(0);
+            },
+            [&]() { g->spawnKoopas(static_cast<uint32_t>(n), none); }));
+    }
+
+    // One bag big enough to knock every Koopa out.
+    template <typename Features>
+    void throwRocks(const char *kernel, size_t n) {
+        unique_ptr<MarioCastleDefense<Features>> g;
+        results.push_back(measure(kernel, n, n, minSeconds,
+            [&]() {
+                g.reset();
+                g = spawned<Features>(n, 0, false);
+                g->bagCapacity = numeric_limits<uint32_t>::max();
+            },
+            [&]() { g->throwRocks(); }));
+    }
+
+    // Push every Koopa into the targeting heap, then pop them all.
+    void heap(size_t n) {
+        ActiveKoopas active;
+        ObjectArena<Koopa> records;
+        uint32_t x = 12345;
+        for (size_t i = 0; i < n; i++) {
+            x = x * 1103515245U + 12345U;
+            Koopa *k = records.create("", KoopaTombstones::NAMED, 1,
+                                      static_cast<KoopaId>(i));
+            active.add(k, x % 100000 + 1, x % 97 + 1, x % 31 + 1, 1);
+        }
+        IndexedHeap<KoopaComparator> queue((KoopaComparator(&active)));
+        results.push_back(measure("KoopaComparator heap push+pop", n, n,
+                                  minSeconds, [](){},
+            [&]() {
+                for (uint32_t slot = 0; slot < n; slot++) queue.push(slot);
+                while (!queue.empty()) queue.pop();
+            }));
+    }
+
+    void medianTracker(size_t n) {
+        vector<uint32_t> lifetimes(n);
+        uint32_t x = 12345;
+        for (uint32_t &v : lifetimes) {
+            x = x * 1103515245U + 12345U;
+            v = x % 10000 + 1;
+        }
+        KnockOutMedianTracker tracker;
+        results.push_back(measure("KnockOutMedianTracker::add", n, n,
+                                  minSeconds,
+            [&]() { tracker = KnockOutMedianTracker(); },
+            [&]() {
+                for (uint32_t v : lifetimes) tracker.add(v);
+                sink = sink + tracker.getMedian();
+            }));
+    }
+
+    // Statistics of ten with half the Koopas knocked out; the text is
+    // formatted but discarded. Items are calls: the cost follows the
+    // entries selected, not n. All Koopas here spawn in one round, so every
+    // live one ties with the tenth and is selected; this is the worst case.
+    void printStats(size_t n) {
+        unique_ptr<MarioCastleDefense<DynamicFeatures>> g =
+            spawned<DynamicFeatures>(n, 10, false);
+        uint64_t half = 0;
+        for (size_t i = 0; i < n / 2; i++) half += g->active.health[i];
+        g->bagCapacity = static_cast<uint32_t>(
+            min<uint64_t>(half, numeric_limits<uint32_t>::max()));
+        g->throwRocks();
+        results.push_back(measure("printStats", n, 1, minSeconds, [](){},
+            [&]() { g->printStats(); }));
+    }
+
+    // Items are raw generator outputs, three per Koopa.
+    void randomDraws(size_t n) {
+        vector<uint32_t> d(n), s(n), h(n);
+        KoopaRandomGenerator rng(7, 100000, 100, 50);
+        results.push_back(measure("MersenneTwister draws", n, 3 * n,
+                                  minSeconds, [](){},
+            [&]() { rng.generateKoopas(n, d.data(), s.data(), h.data()); }));
+    }
+
+    // Waves of up to 1000 named Koopas; items are Koopa lines.
+    void parser(size_t n) {
+        string text = "COMMENT: bench\nBag-Capacity: 10\nSeed: 1\n"
+                      "Max-Rand-Distance: 100\nMax-Rand-Speed: 10\n"
+                      "Max-Rand-Health: 5\n";
+        for (size_t done = 0, wave = 1; done < n; wave++) {
+            size_t k = min<size_t>(1000, n - done);
+            text += "---\nwave: " + to_string(wave) + "\nrandom-koopas: 3\n"
+                    "named-koopas: " + to_string(k) + "\n";
+            for (size_t i = 0; i < k; i++, done++) {
+                text += "boo" + to_string(done) + " distance: " +
+                        to_string(done % 5000 + 1) + " speed: " +
+                        to_string(done % 7 + 1) + " health: " +
+                        to_string(done % 9 + 1) + "\n";
+            }
+        }
+        results.push_back(measure("ScenarioParser", n, n, minSeconds, [](){},
+            [&]() {
+                ScenarioParser p(text.data(), text.data() + text.size());
+                p.readHeader();
+                RoundConfig rc;
+                while (p.nextWave(rc)) sink = sink + rc.koopas.size();
+            }));
+    }
+};
+
+int main(int argc, char *argv[]) {
+    size_t maxSize = 10000000;
+    double minSeconds = 0.2;
+    static struct option longOpts[] = {
+        {"max-size", required_argument, nullptr, 'n'},
+        {"min-time", required_argument, nullptr, 't'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt, idx;
+    while ((opt = getopt_long(argc, argv, "n:t:", longOpts, &idx)) != -1) {
+        switch (opt) {
+            case 'n': maxSize = static_cast<size_t>(strtoull(optarg, nullptr, 10)); break;
+            case 't': minSeconds = strtod(optarg, nullptr); break;
+            default:
+                fprintf(stderr, "Usage: %s [--max-size N] [--min-time SECONDS]\n",
+                        argv[0]);
+                return 1;
+        }
+    }
+    EngineBench bench(maxSize, minSeconds);
+    bench.runAll();
+    bench.printJson();
+    return 0;
+}
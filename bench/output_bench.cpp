@@ -0,0 +1,90 @@
+// output_bench.cpp   Lines per second for verbose "Moved:" output, chained
+// iostream inserts versus OutputWriter. Both write to /dev/null so the
+// numbers measure formatting and syscall overhead, not the terminal.
+
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <fcntl.h>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+#include "../OutputWriter.h"
+
+using namespace std;
+
+namespace {
+
+struct Row {
+    string   name;
+    uint32_t distance;
+    uint32_t speed;
+    uint32_t health;
+};
+
+vector<Row> makeRows(size_t n) {
+    static const char *bases[] = { "greenKoopa", "redKoopa", "spiny",
+                                   "hammerBro", "dryBones", "paraTroopa" };
+    vector<Row> rows;
+    rows.reserve(n);
+    uint32_t x = 12345;
+    for (size_t i = 0; i < n; i++) {
+        x = x * 1103515245U + 12345U;
+        rows.push_back({ string(bases[i % 6]) + to_string(i),
+                         x % 100000, x % 97 + 1, x % 31 + 1 });
+    }
+    return rows;
+}
+
+template <typename Fn>
+double linesPerSecond(size_t lines, Fn fn) {
+    auto start = chrono::steady_clock::now();
+    fn();
+    chrono::duration<double> took = chrono::steady_clock::now() - start;
+    return static_cast<double>(lines) / took.count();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    size_t rows = 100000;
+    size_t passes = 50;
+    if (argc > 1) passes = static_cast<size_t>(stoul(argv[1]));
+    vector<Row> data = makeRows(rows);
+    size_t lines = rows * passes;
+
+    double viaStream = linesPerSecond(lines, [&]() {
+        ofstream os("/dev/null");
+        for (size_t p = 0; p < passes; p++) {
+            for (const Row &r : data) {
+                os << "Moved: " << r.name
+                   << " (distance: " << r.distance
+                   << ", speed: " << r.speed
+                   << ", health: " << r.health << ")\n";
+            }
+        }
+    });
+
+    double viaWriter = linesPerSecond(lines, [&]() {
+        int fd = open("/dev/null", O_WRONLY);
+        {
+            OutputWriter out(fd);
+            for (size_t p = 0; p < passes; p++) {
+                for (const Row &r : data) {
+                    out << "Moved: " << r.name
+                        << " (distance: " << r.distance
+                        << ", speed: " << r.speed
+                        << ", health: " << r.health << ")\n";
+                }
+            }
+        }
+        close(fd);
+    });
+
+    printf("lines          %zu\n", lines);
+    printf("ostream        %.3g lines/s\n", viaStream);
+    printf("OutputWriter   %.3g lines/s\n", viaWriter);
+    printf("speedup        %.2fx\n", viaWriter / viaStream);
+    return 0;
+}
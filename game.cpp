@@ -1,5 +1,6 @@
 #include <iostream>
 #include <string>
+#include <string_view>
 #include <vector>
 #include <queue>
 #include <sstream>
@@ -7,319 +8,1244 @@
 #include <cstdint>
 #include <cstdlib>
 #include <getopt.h>
+#include <unistd.h>
 #include <limits>
+#include <new>
+#include <utility>
+#include <memory>
+#include <fcntl.h>
+#include <thread>
+#include <charconv>
+#include <map>
 #include "KoopaRandomGenerator.h"
+#include "KoopaMoveKernel.h"
+#include "IndexedHeap.h"
+#include "KnockOutMedianTracker.h"
+#include "ScenarioParser.h"
+#include "OutputWriter.h"
+#include "KoopaTrace.h"
+#include "GameSnapshot.h"
+#include "WorkStealingRange.h"
+#include "PhaseProfile.h"
+#include "WaveStream.h"
 
 using namespace std;
 
-struct RoundConfig {
-    uint32_t waveNumber;
-    uint32_t randomKoopas;
-    uint32_t namedKoopas;
-    vector<string> koopaLines;
-};
+typedef uint32_t KoopaId;
+
+// Makes room for n elements while keeping geometric growth, so reserving
+// ahead of every batch stays amortized O(1) per element.
+template <typename T>
+void reserveFor(vector<T> &v, size_t n) {
+    if (v.capacity() < n) v.reserve(max(n, 2 * v.capacity()));
+}
 
+// Record of an active Koopa, read when printing. The fields touched every
+// round live in ActiveKoopas. On knock-out the record is reclaimed and only
+// a KoopaTombstones entry is kept.
 class Koopa {
 public:
-    string   name;
-    uint32_t distanceToCastle;
-    uint32_t walkSpeed;
-    uint32_t shellHP;
+    string   name;         // empty for a random Koopa, see nameOf()
+    uint64_t nameId;       // see KoopaTombstones
     uint32_t spawnRound;
-    uint32_t knockOutRound;
-    bool     isActive;
-    size_t   spawnOrder;
-    uint32_t knockOutOrder;
+    KoopaId  id;           // spawn order
 
-    Koopa(const string &n, uint32_t dist, uint32_t sp, uint32_t hp,
-          uint32_t sRound, size_t order)
+    Koopa(string_view n, uint64_t nid, uint32_t sRound, KoopaId i)
      : name(n),
-       distanceToCastle(dist),
-       walkSpeed(sp),
-       shellHP(hp),
+       nameId(nid),
        spawnRound(sRound),
-       knockOutRound(0),
-       isActive(true),
-       spawnOrder(order),
-       knockOutOrder(0)
+       id(i)
     {}
+};
+
+// Targeting priority packed into integers: the arrival round (see
+// KoopaComparator) in one word, health and name rank in the other, so a
+// heap comparison is a pair of integer compares. Arrival needs up to 33
+// bits and health and rank 32 each, which is why it takes two words.
+//
+// Equal names rank in spawn order, so Koopas that tie on arrival, health
+// and name are targeted earliest-spawned first. The original engine left
+// such full ties to std::priority_queue's internal layout, so a scenario
+// with repeated names can end differently (regression case tie_names).
+struct PriorityKey {
+    uint64_t arrival;
+    uint64_t healthRank;
+
+    PriorityKey(uint64_t arr, uint32_t hp)
+      : arrival(arr), healthRank(static_cast<uint64_t>(hp) << 32) {}
+
+    bool operator<(const PriorityKey &other) const {
+        if (arrival != other.arrival) return arrival < other.arrival;
+        return healthRank < other.healthRank;
+    }
+
+    uint32_t rank() const {
+        return static_cast<uint32_t>(healthRank);
+    }
+
+    void setRank(uint32_t r) {
+        healthRank = (healthRank & ~0xffffffffULL) | r;
+    }
+
+    void loseHealth(uint32_t hp) {
+        healthRank -= static_cast<uint64_t>(hp) << 32;
+    }
+};
+
+// Hot fields of the active Koopas as dense parallel columns. Knocking a
+// Koopa out moves the last slot into its place, so a pass over the columns
+// costs O(active Koopas) no matter how many were ever spawned.
+//
+// Swap-remove scrambles the slot order, so the set also keeps the slots in
+// spawn order for printing. Removal leaves a hole in that list; once the
+// holes outnumber the live entries it is compacted, keeping a walk over it
+// O(active Koopas) amortized as well.
+class ActiveKoopas {
+public:
+    vector<uint32_t> distance;
+    vector<uint32_t> speed;
+    vector<uint32_t> health;
+    vector<PriorityKey> key;
+    vector<KoopaId>  id;
+    vector<Koopa*>   record;
+
+    size_t size() const {
+        return distance.size();
+    }
+
+    void reserve(size_t n) {
+        reserveFor(distance, n);
+        reserveFor(speed, n);
+        reserveFor(health, n);
+        reserveFor(key, n);
+        reserveFor(id, n);
+        reserveFor(record, n);
+        reserveFor(orderPos, n);
+        reserveFor(order, n + holes);
+    }
+
+    uint32_t add(Koopa *k, uint32_t dist, uint32_t sp, uint32_t hp,
+                 uint32_t round) {
+        uint32_t slot = static_cast<uint32_t>(size());
+        distance.push_back(dist);
+        speed.push_back(sp);
+        health.push_back(hp);
+        key.push_back(PriorityKey(static_cast<uint64_t>(dist / sp) + round, hp));
+        id.push_back(k->id);
+        record.push_back(k);
+        orderPos.push_back(static_cast<uint32_t>(order.size()));
+        order.push_back(slot);
+        return slot;
+    }
+
+    // Removes `slot` by moving the last slot into it. Returns the old index
+    // of the Koopa that now lives in `slot` (equal to `slot` if none moved).
+    uint32_t remove(uint32_t slot) {
+        uint32_t last = static_cast<uint32_t>(size() - 1);
+        order[orderPos[slot]] = HOLE;
+        holes++;
+        if (slot != last) {
+            distance[slot] = distance[last];
+            speed[slot] = speed[last];
+            health[slot] = health[last];
+            key[slot] = key[last];
+            id[slot] = id[last];
+            record[slot] = record[last];
+            orderPos[slot] = orderPos[last];
+            order[orderPos[slot]] = slot;
+        }
+        distance.pop_back();
+        speed.pop_back();
+        health.pop_back();
+        key.pop_back();
+        id.pop_back();
+        record.pop_back();
+        orderPos.pop_back();
+        if (holes > size()) {
+            compactOrder();
+        }
+        return last;
+    }
+
+    // Calls fn(slot) for every active Koopa in spawn order.
+    template <typename Fn>
+    void forEachInSpawnOrder(Fn fn) const {
+        for (uint32_t slot : order) {
+            if (slot != HOLE) fn(slot);
+        }
+    }
+
+    // Walks the active Koopas in spawn order, newest first if asked, until
+    // fn(slot) returns false.
+    template <typename Fn>
+    void walkSpawnOrder(bool newestFirst, Fn fn) const {
+        if (newestFirst) {
+            for (size_t i = order.size(); i-- > 0;) {
+                if (order[i] != HOLE && !fn(order[i])) return;
+            }
+        } else {
+            for (uint32_t slot : order) {
+                if (slot != HOLE && !fn(slot)) return;
+            }
+        }
+    }
+
+    void save(SnapshotWriter &w) const {
+        w.put(size());
+        for (size_t slot = 0; slot < size(); slot++) {
+            w.put(distance[slot]);
+            w.put(speed[slot]);
+            w.put(health[slot]);
+            w.put(key[slot].arrival);
+            w.put(key[slot].healthRank);
+            w.put(id[slot]);
+        }
+        w.put(order.size());
+        for (uint32_t slot : order) {
+            w.put(slot == HOLE ? 0 : static_cast<uint64_t>(slot) + 1);
+        }
+    }
+
+    // Loads the set saved by save(); ids must be below koopaCount. The
+    // records are left null for the caller to fill in.
+    void load(SnapshotReader &r, size_t koopaCount) {
+        size_t n = r.getCount();
+        distance.resize(n);
+        speed.resize(n);
+        health.resize(n);
+        key.assign(n, PriorityKey(0, 0));
+        id.resize(n);
+        record.assign(n, nullptr);
+        for (size_t slot = 0; slot < n; slot++) {
+            distance[slot] = r.get32();
+            speed[slot] = r.get32();
+            health[slot] = r.get32();
+            key[slot].arrival = r.get();
+            key[slot].healthRank = r.get();
+            id[slot] = r.get32();
+            if (speed[slot] == 0 || id[slot] >= koopaCount) r.fail();
+        }
+        order.resize(r.getCount());
+        orderPos.assign(n, HOLE);
+        holes = 0;
+        for (size_t i = 0; i < order.size(); i++) {
+            uint64_t v = r.get();
+            if (v > n) r.fail();
+            if (v == 0) {
+                order[i] = HOLE;
+                holes++;
+                continue;
+            }
+            order[i] = static_cast<uint32_t>(v - 1);
+            if (orderPos[order[i]] != HOLE) r.fail();
+            orderPos[order[i]] = static_cast<uint32_t>(i);
+        }
+        if (order.size() - holes != n) r.fail();
+    }
+
+private:
+    static constexpr uint32_t HOLE = numeric_limits<uint32_t>::max();
+
+    vector<uint32_t> orderPos;
+    vector<uint32_t> order;
+    size_t holes = 0;
 
-    uint32_t getETA() const {
-        return distanceToCastle / walkSpeed;
+    void compactOrder() {
+        size_t out = 0;
+        for (uint32_t slot : order) {
+            if (slot == HOLE) continue;
+            orderPos[slot] = static_cast<uint32_t>(out);
+            order[out++] = slot;
+        }
+        order.resize(out);
+        holes = 0;
     }
+};
+
+// Chunked slab pool that owns every object it creates. Objects are
+// constructed back to back inside fixed-size chunks, so a spawn costs O(1)
+// with no per-object malloc and addresses stay stable until destroy(). A
+// destroyed object's slot goes on a free list and is reused first, so the
+// arena only grows with the peak number of live objects. All storage is
+// released in one pass when the arena goes away.
+template <typename T, size_t ChunkObjects = 4096>
+class ObjectArena {
+private:
+    struct Chunk {
+        alignas(T) unsigned char bytes[sizeof(T) * ChunkObjects];
+    };
+    vector<Chunk*> chunks;
+    size_t usedInLast;
+    vector<T*> freeSlots;
+
+public:
+    ObjectArena() : usedInLast(ChunkObjects) {}
+    ~ObjectArena() { release(); }
 
-    uint32_t getActiveRounds(uint32_t endRound) const {
-        if (!isActive && knockOutOrder != 0) {
-            return knockOutRound - spawnRound + 1;
+    ObjectArena(const ObjectArena&) = delete;
+    ObjectArena &operator=(const ObjectArena&) = delete;
+
+    template <typename... Args>
+    T *create(Args&&... args) {
+        T *slot;
+        if (!freeSlots.empty()) {
+            slot = freeSlots.back();
+            freeSlots.pop_back();
+        } else {
+            if (usedInLast == ChunkObjects) {
+                chunks.push_back(new Chunk);
+                usedInLast = 0;
+            }
+            slot = reinterpret_cast<T*>(chunks.back()->bytes) + usedInLast;
+            usedInLast++;
         }
-        if (!isActive && knockOutOrder == 0) {
-            return knockOutRound - spawnRound + 1;
+        new (slot) T(std::forward<Args>(args)...);
+        return slot;
+    }
+
+    void destroy(T *obj) {
+        obj->~T();
+        freeSlots.push_back(obj);
+    }
+
+    void release() {
+        sort(freeSlots.begin(), freeSlots.end(), less<T*>());
+        for (size_t c = 0; c < chunks.size(); c++) {
+            T *first = reinterpret_cast<T*>(chunks[c]->bytes);
+            size_t count = (c + 1 == chunks.size()) ? usedInLast : ChunkObjects;
+            for (size_t i = 0; i < count; i++) {
+                if (!binary_search(freeSlots.begin(), freeSlots.end(),
+                                   first + i, less<T*>())) {
+                    first[i].~T();
+                }
+            }
+            delete chunks[c];
         }
-        return endRound - spawnRound + 1;
+        chunks.clear();
+        freeSlots.clear();
+        usedInLast = ChunkObjects;
     }
 };
 
+// What is kept of the knocked-out Koopas once their records are reclaimed,
+// in knock-out order, so an entry's knock-out order is its position plus
+// one. A random Koopa's name id is its generator index and its name is
+// rebuilt with koopaName(); other names are packed into one buffer and
+// their id is NAMED plus their position in it.
+class KoopaTombstones {
+public:
+    static constexpr uint64_t NAMED = 1ULL << 63;
+
+    struct Tombstone {
+        uint64_t nameId;
+        uint32_t spawnRound;
+        uint32_t knockOutRound;
+    };
+
+    // Returns the Koopa's knock-out order.
+    uint32_t add(const Koopa &k, uint32_t round) {
+        uint64_t nameId = k.nameId;
+        if (nameId == NAMED) {
+            nameId = NAMED | nameEnds.size();
+            names += k.name;
+            nameEnds.push_back(names.size());
+        }
+        stones.push_back({ nameId, k.spawnRound, round });
+        return static_cast<uint32_t>(stones.size());
+    }
+
+    size_t size() const {
+        return stones.size();
+    }
+
+    // order = 1 for the first Koopa knocked out.
+    const Tombstone &byOrder(size_t order) const {
+        return stones[order - 1];
+    }
+
+    string name(const Tombstone &t) const {
+        if (!(t.nameId & NAMED)) {
+            return KoopaRandomGenerator::koopaName(
+                static_cast<uint32_t>(t.nameId));
+        }
+        size_t i = static_cast<size_t>(t.nameId & ~NAMED);
+        size_t begin = i ? nameEnds[i - 1] : 0;
+        return names.substr(begin, nameEnds[i] - begin);
+    }
+
+    void save(SnapshotWriter &w) const {
+        w.put(stones.size());
+        for (const Tombstone &t : stones) {
+            w.put(t.nameId);
+            w.put(t.spawnRound);
+            w.put(t.knockOutRound);
+        }
+        w.putString(names);
+        w.put(nameEnds.size());
+        for (size_t end : nameEnds) w.put(end);
+    }
+
+    void load(SnapshotReader &r) {
+        stones.resize(r.getCount());
+        for (Tombstone &t : stones) {
+            t.nameId = r.get();
+            t.spawnRound = r.get32();
+            t.knockOutRound = r.get32();
+        }
+        names = r.getString();
+        nameEnds.resize(r.getCount());
+        size_t prev = 0;
+        for (size_t &end : nameEnds) {
+            end = static_cast<size_t>(r.get());
+            if (end < prev || end > names.size()) r.fail();
+            prev = end;
+        }
+        if (prev != names.size()) r.fail();
+        for (const Tombstone &t : stones) {
+            bool named = (t.nameId & NAMED) != 0;
+            if (named ? (t.nameId & ~NAMED) >= nameEnds.size()
+                      : t.nameId > UINT32_MAX) {
+                r.fail();
+            }
+        }
+    }
+
+private:
+    vector<Tombstone> stones;
+    string names;
+    vector<size_t> nameEnds;
+};
+
+// Targeting order over active slots: lowest ETA first, then lowest
+// health, then name, compared through each slot's PriorityKey. Every
+// Koopa in the queue moves each round and its ETA (distance / speed)
+// drops by exactly one per move -- a Koopa that cannot cover a full step
+// reaches the castle and ends the game -- so the ETA order is the order of
+// spawn ETA plus spawn round. Keying on that arrival round keeps the heap
+// exact without re-keying after moves.
 class KoopaComparator {
+private:
+    const ActiveKoopas *active;
+public:
+    explicit KoopaComparator(const ActiveKoopas *a) : active(a) {}
+
+    bool operator()(uint32_t a, uint32_t b) const {
+        return active->key[a] < active->key[b];
+    }
+};
+
+// One line of the "Most/Least active Koopas" statistics.
+struct StatEntry {
+    string   name;
+    uint32_t rounds;
+};
+
+// Order of the "Most active Koopas" list: more rounds first, then name.
+struct MoreActive {
+    bool operator()(uint32_t aRounds, const string &aName,
+                    uint32_t bRounds, const string &bName) const {
+        if (aRounds != bRounds) return aRounds > bRounds;
+        return aName < bName;
+    }
+    bool operator()(const StatEntry &a, const StatEntry &b) const {
+        return (*this)(a.rounds, a.name, b.rounds, b.name);
+    }
+};
+
+// Order of the "Least active Koopas" list: fewer rounds first, then name.
+struct LessActive {
+    bool operator()(uint32_t aRounds, const string &aName,
+                    uint32_t bRounds, const string &bName) const {
+        if (aRounds != bRounds) return aRounds < bRounds;
+        return aName < bName;
+    }
+    bool operator()(const StatEntry &a, const StatEntry &b) const {
+        return (*this)(a.rounds, a.name, b.rounds, b.name);
+    }
+};
+
+// Keeps the `limit` entries that come first under Before out of everything
+// offered, as a heap with the entry that would be dropped next on top. An
+// offer costs O(1) when rejected and O(log limit) when kept.
+template <typename Before>
+class BoundedSelection {
+private:
+    size_t limit;
+    vector<StatEntry> heap;
+    Before before;
+
 public:
-    bool operator()(const Koopa *a, const Koopa *b) const {
-        uint32_t etaA = a->getETA();
-        uint32_t etaB = b->getETA();
-        if (etaA != etaB) return etaA > etaB;
-        if (a->shellHP != b->shellHP) return a->shellHP > b->shellHP;
-        return a->name > b->name;
+    explicit BoundedSelection(size_t lim = 0) : limit(lim) {}
+
+    void offer(uint32_t rounds, const string &name) {
+        if (heap.size() < limit) {
+            heap.push_back({ name, rounds });
+            push_heap(heap.begin(), heap.end(), before);
+        } else if (limit > 0 &&
+                   before(rounds, name, heap.front().rounds, heap.front().name)) {
+            pop_heap(heap.begin(), heap.end(), before);
+            heap.back() = { name, rounds };
+            push_heap(heap.begin(), heap.end(), before);
+        }
+    }
+
+    const vector<StatEntry> &entries() const {
+        return heap;
+    }
+
+    void save(SnapshotWriter &w) const {
+        w.put(heap.size());
+        for (const StatEntry &e : heap) {
+            w.putString(e.name);
+            w.put(e.rounds);
+        }
+    }
+
+    void load(SnapshotReader &r) {
+        heap.resize(r.getCount());
+        for (StatEntry &e : heap) {
+            e.name = r.getString();
+            e.rounds = r.get32();
+        }
+        if (heap.size() > limit ||
+            !is_heap(heap.begin(), heap.end(), before)) {
+            r.fail();
+        }
     }
 };
 
-class KnockOutMedianTracker {
+// Names of the first and the last `limit` Koopas knocked out; the last
+// ones sit in a ring buffer.
+class KnockOutLog {
 private:
-    priority_queue<uint32_t, vector<uint32_t>, less<uint32_t>> lowerHalf;
-    priority_queue<uint32_t, vector<uint32_t>, greater<uint32_t>> upperHalf;
+    size_t limit;
+    vector<string> first;
+    vector<string> ring;
+    size_t ringNext;
+
 public:
-    void add(uint32_t val) {
-        if (lowerHalf.empty() || val <= lowerHalf.top()) {
-            lowerHalf.push(val);
-        } else {
-            upperHalf.push(val);
+    explicit KnockOutLog(size_t lim = 0) : limit(lim), ringNext(0) {}
+
+    void record(const string &name) {
+        if (first.size() < limit) {
+            first.push_back(name);
         }
-        if (lowerHalf.size() > upperHalf.size() + 1) {
-            upperHalf.push(lowerHalf.top());
-            lowerHalf.pop();
-        } else if (upperHalf.size() > lowerHalf.size() + 1) {
-            lowerHalf.push(upperHalf.top());
-            upperHalf.pop();
+        if (ring.size() < limit) {
+            ring.push_back(name);
+        } else if (limit > 0) {
+            ring[ringNext] = name;
+            ringNext = (ringNext + 1) % limit;
         }
     }
-    bool empty() const {
-        return lowerHalf.empty() && upperHalf.empty();
+
+    // min(knock-outs so far, limit)
+    size_t size() const {
+        return first.size();
+    }
+
+    const string &firstOut(size_t i) const {
+        return first[i];
     }
-    uint32_t getMedian() const {
-        if (lowerHalf.empty() && upperHalf.empty()) return 0;
-        if (lowerHalf.size() == upperHalf.size()) {
-            uint64_t a = lowerHalf.top();
-            uint64_t b = upperHalf.top();
-            return static_cast<uint32_t>((a + b) / 2ULL);
-        } else if (lowerHalf.size() > upperHalf.size()) {
-            return lowerHalf.top();
+
+    // i = 0 is the most recent knock-out.
+    const string &lastOut(size_t i) const {
+        size_t newest = ring.size() < limit ? ring.size() - 1
+                                            : (ringNext + limit - 1) % limit;
+        return ring[(newest + ring.size() - i) % ring.size()];
+    }
+
+    void save(SnapshotWriter &w) const {
+        w.put(first.size());
+        for (const string &name : first) w.putString(name);
+        w.put(ring.size());
+        for (const string &name : ring) w.putString(name);
+        w.put(ringNext);
+    }
+
+    void load(SnapshotReader &r) {
+        first.resize(r.getCount());
+        for (string &name : first) name = r.getString();
+        ring.resize(r.getCount());
+        for (string &name : ring) name = r.getString();
+        uint64_t next = r.get();
+        if (first.size() > limit || ring.size() != first.size() ||
+            (next != 0 && (next >= ring.size() || ring.size() < limit))) {
+            r.fail();
         }
-        return upperHalf.top();
+        ringNext = static_cast<size_t>(next);
+    }
+};
+
+// A requested quantile of knock-out lifetimes, as given on the command
+// line ("p90") and in thousandths of a percent (90000).
+struct Percentile {
+    string   label;
+    uint32_t milli;
+};
+
+// Parses "p50,p90,p99.9" (the leading p is optional). Returns false on
+// anything that is not a percentile in [0, 100].
+bool parsePercentiles(const string &spec, vector<Percentile> &out) {
+    istringstream iss(spec);
+    string item;
+    while (getline(iss, item, ',')) {
+        string num = (!item.empty() && item[0] == 'p') ? item.substr(1) : item;
+        if (num.empty()) return false;
+        uint64_t whole = 0, frac = 0, fracDigits = 0;
+        bool inFrac = false;
+        for (char c : num) {
+            if (c == '.' && !inFrac) { inFrac = true; continue; }
+            if (c < '0' || c > '9') return false;
+            if (inFrac) {
+                if (++fracDigits > 3) return false;
+                frac = frac * 10 + static_cast<uint64_t>(c - '0');
+            } else {
+                whole = whole * 10 + static_cast<uint64_t>(c - '0');
+                if (whole > 100) return false;
+            }
+        }
+        for (; fracDigits < 3; fracDigits++) frac *= 10;
+        uint64_t milli = whole * 1000 + frac;
+        if (milli > 100000) return false;
+        out.push_back({ "p" + num, static_cast<uint32_t>(milli) });
+    }
+    return !out.empty();
+}
+
+// The random Koopas of a whole scenario, drawn up front so that many games
+// over the same waves need not each draw them again. Entry i is the i-th
+// random Koopa a game with this header spawns.
+struct RandomKoopaPool {
+    vector<uint32_t> distance;
+    vector<uint32_t> speed;
+    vector<uint32_t> health;
+
+    void generate(const ScenarioHeader &header,
+                  const vector<RoundConfig> &waves, unsigned threads) {
+        size_t total = 0;
+        for (const RoundConfig &w : waves) total += w.randomKoopas;
+        distance.resize(total);
+        speed.resize(total);
+        health.resize(total);
+        KoopaRandomGenerator rng(header.seed, header.maxDistance,
+                                 header.maxSpeed, header.maxHealth);
+        rng.generateKoopas(total, distance.data(), speed.data(),
+                           health.data(), threads);
+    }
+};
+
+// Which optional output a game produces: the verbose log, knock-out
+// lifetimes (--median, --percentiles, sweeps) and the statistics. The
+// engine is a template on one of these. QuietFeatures turns them all off,
+// so they compile out of the round loop along with their checks;
+// DynamicFeatures takes the options at run time. engine_bench times the
+// two against each other.
+struct QuietFeatures {
+    QuietFeatures(bool, bool, bool) {}
+
+    static constexpr bool verbose() { return false; }
+    static constexpr bool lifetimes() { return false; }
+    static constexpr bool stats() { return false; }
+};
+
+class DynamicFeatures {
+public:
+    DynamicFeatures(bool verbose, bool lifetimes, bool stats)
+      : verbose_(verbose), lifetimes_(lifetimes), stats_(stats) {}
+
+    bool verbose() const { return verbose_; }
+    bool lifetimes() const { return lifetimes_; }
+    bool stats() const { return stats_; }
+
+    void keepLifetimes() { lifetimes_ = true; }
+
+private:
+    bool verbose_;
+    bool lifetimes_;
+    bool stats_;
+};
+
+// Reads the remaining wave blocks and orders them by wave number. Waves
+// with the same number keep their file order, as when streamed.
+void readWaves(ScenarioParser &parser, vector<RoundConfig> &waves) {
+    RoundConfig rc;
+    while (parser.nextWave(rc)) {
+        waves.push_back(std::move(rc));
     }
+    stable_sort(waves.begin(), waves.end(),
+         [](const RoundConfig &a, const RoundConfig &b){
+             return a.waveNumber < b.waveNumber;
+         });
+}
+
+// Outcome of a finished game.
+struct GameResult {
+    bool     victory;
+    uint32_t endRound;
+    uint32_t medianLifetime;   // 0 if nothing was knocked out
+    uint32_t knockedOut;
+};
+
+// How close a game came to losing in one round.
+struct RoundMargin {
+    uint32_t round;
+    uint32_t spareRocks;     // rocks left in the bag after throwing
+    uint32_t nearestMoves;   // moves until the next breach, 0 if none
 };
 
+// One game. Everything it touches, including its random generator, is
+// owned by the object, so independent games can run on separate threads.
+template <typename Features>
 class MarioCastleDefense {
+    // bench/engine_bench.cpp times the round phases directly.
+    friend class EngineBench;
+
 private:
     uint32_t bagCapacity;
-    vector<RoundConfig> waveConfigs;
+    KoopaRandomGenerator rng;
+    unsigned generatorThreads;
+    const RandomKoopaPool *randomPool;
+    size_t randomPoolNext;
+    vector<RoundConfig> ownWaves;
+    WaveSource *waveSource;
+    const RoundConfig *pendingWave;   // next wave to spawn, null if none
     size_t currentWaveIndex;
-    uint32_t nextWaveNumber;
+    bool streamInput;
+    bool parseAhead;
 
-    vector<Koopa*> allKoopas;
-    size_t koopaCounter;
+    ActiveKoopas active;
+    ObjectArena<Koopa> koopaArena;
+    KoopaTombstones tombstones;
+    KoopaId koopaCounter;
 
-    priority_queue<Koopa*, vector<Koopa*>, KoopaComparator> targetQueue;
+    IndexedHeap<KoopaComparator> targetQueue;
+    uint32_t rankedCount;
+    vector<uint32_t> rankScratch;
+    vector<uint32_t> rankMerged;
+    vector<uint64_t> nameKeys;
+    string nameScratch;
+    string otherNameScratch;
+    vector<uint32_t> spawnTargets;
+    vector<uint32_t> randDistance;
+    vector<uint32_t> randSpeed;
+    vector<uint32_t> randHealth;
     uint32_t activeKoopaCount;
     uint32_t currentRound;
     bool gameOver;
+    bool victory;
 
-    bool verbose;
+    Features features;
     bool trackMedian;
+    vector<Percentile> percentiles;
     uint32_t statsCount;
 
     uint32_t knockOutCounter;
+    KoopaId lastKnockedOut;   // valid once knockOutCounter > 0
+    KnockOutLog knockOutLog;
+    BoundedSelection<MoreActive> mostActiveOut;
+    BoundedSelection<LessActive> leastActiveOut;
     KnockOutMedianTracker medianTracker;
+    OutputWriter out;
+    unique_ptr<TraceWriter> trace;
+    vector<uint32_t> traceBreached;
+    unique_ptr<PhaseProfiler> profiler;
+
+    string checkpointPath;
+    uint32_t checkpointEvery;
+    string resumePath;
+    uint64_t scenarioHash;
+
+    bool decideEarly;
+    vector<uint64_t> healthDue;   // by moves to the castle, for outcomeDecided()
+
+    vector<RoundMargin> *margins;
 
 public:
-    MarioCastleDefense(bool v, bool m, uint32_t s)
+    // With QuietFeatures the options must not ask for any feature.
+    MarioCastleDefense(bool v, bool m, uint32_t s,
+                       const vector<Percentile> &p = vector<Percentile>(),
+                       int outFd = STDOUT_FILENO)
       : bagCapacity(0),
+        generatorThreads(1),
+        randomPool(nullptr),
+        randomPoolNext(0),
+        waveSource(nullptr),
+        pendingWave(nullptr),
         currentWaveIndex(0),
-        nextWaveNumber(numeric_limits<uint32_t>::max()),
+        streamInput(false),
+        parseAhead(false),
         koopaCounter(0),
+        targetQueue(KoopaComparator(&active)),
+        rankedCount(0),
         activeKoopaCount(0),
         currentRound(0),
         gameOver(false),
-        verbose(v),
+        victory(false),
+        features(v, m || !p.empty(), s > 0),
         trackMedian(m),
+        percentiles(p),
         statsCount(s),
-        knockOutCounter(0)
+        knockOutCounter(0),
+        lastKnockedOut(0),
+        knockOutLog(s),
+        mostActiveOut(s),
+        leastActiveOut(s),
+        out(outFd, outFd < 0 ? 64 : 1 << 20),
+        checkpointEvery(0),
+        scenarioHash(0),
+        decideEarly(false),
+        margins(nullptr)
     {}
 
-    ~MarioCastleDefense() {
-        for (auto *k : allKoopas) {
-            delete k;
-        }
+    // Also record the game as a binary trace on fd (see KoopaTrace.h).
+    void traceTo(int fd) {
+        trace.reset(new TraceWriter(fd));
+    }
+
+    // Time the round phases and print a summary to stderr at the end; with
+    // traceFd >= 0 also write them there as a Chrome trace.
+    void profileTo(int traceFd) {
+        profiler.reset(new PhaseProfiler(traceFd));
+    }
+
+    // Draw large random waves on up to `threads` threads. The Koopas are
+    // the same as with one thread.
+    void generateWith(unsigned threads) {
+        generatorThreads = threads;
+    }
+
+    // Save the whole game to `path` at the end of every `every`-th round.
+    void checkpointTo(const string &path, uint32_t every) {
+        checkpointPath = path;
+        checkpointEvery = every;
+    }
+
+    // Continue the game saved in `path` instead of starting at round 1.
+    // The scenario on stdin must be the one the checkpoint was taken from.
+    void resumeFrom(const string &path) {
+        resumePath = path;
+    }
+
+    // Read the scenario wave by wave as the game reaches each wave instead
+    // of loading it all first (see openWaveStream()).
+    void streamWaves() {
+        streamInput = true;
+    }
+
+    // Stream the waves through a producer thread that parses them and
+    // draws their random Koopas ahead of the game (see ParseAheadWaves).
+    void parseWavesAhead() {
+        streamInput = true;
+        parseAhead = true;
+    }
+
+    // Record knock-out lifetimes for result() even without --median.
+    void keepLifetimes() {
+        features.keepLifetimes();
+    }
+
+    GameResult result() const {
+        return { victory, currentRound, medianTracker.getMedian(),
+                 knockOutCounter };
+    }
+
+    // Spawn the random Koopas from `pool` instead of drawing them. The pool
+    // must have been generated for the header and waves passed to play().
+    void useRandomKoopas(const RandomKoopaPool *pool) {
+        randomPool = pool;
+    }
+
+    // End the game as soon as its outcome is certain (see outcomeDecided()).
+    // result() then reports the round of the decision, not of the end.
+    void decideOutcomeEarly() {
+        decideEarly = true;
+    }
+
+    // Append a Margin for every round played to `to`.
+    void recordMargins(vector<RoundMargin> &to) {
+        margins = &to;
+    }
+
+    // Rounds an active Koopa has been on the field, the current included.
+    uint32_t getActiveRounds(const Koopa *k) const {
+        return currentRound - k->spawnRound + 1;
     }
 
-    void readHeader() {
+    void moveKoopas() {
+        // Spawning happens after the move phase, so every active Koopa was
+        // spawned in an earlier round and takes a step.
+        size_t n = active.size();
+        size_t hit;
         {
-            string ignored;
-            getline(cin, ignored);
+            PhaseScope timer(profiler.get(), PhaseProfiler::MOVE);
+            hit = KoopaMoveKernel::advance(active.distance.data(),
+                                           active.speed.data(), n);
+            if (features.verbose()) {
+                active.forEachInSpawnOrder([this](uint32_t slot) {
+                    out << "Moved: " << nameOf(active.record[slot])
+                        << " (distance: " << active.distance[slot]
+                        << ", speed: " << active.speed[slot]
+                        << ", health: " << active.health[slot] << ")\n";
+                });
+            }
+            if (trace) {
+                uint64_t distanceSum = 0;
+                traceBreached.clear();
+                for (size_t i = 0; i < n; i++) {
+                    distanceSum += active.distance[i];
+                    if (i >= hit && active.distance[i] == 0) {
+                        traceBreached.push_back(active.id[i]);
+                    }
+                }
+                trace->moves(n, distanceSum, traceBreached);
+            }
+            if (profiler) profiler->count(PhaseProfiler::MOVED, n);
         }
-        {
-            string dummy;
-            uint32_t seed, maxDist, maxSpeed, maxHP;
-            cin >> dummy >> bagCapacity;
-            cin >> dummy >> seed;
-            cin >> dummy >> maxDist;
-            cin >> dummy >> maxSpeed;
-            cin >> dummy >> maxHP;
-            KoopaRandomGenerator::initialize(seed, maxDist, maxSpeed, maxHP);
-        }
-    }
-
-    void readWaves() {
-        while (true) {
-            string firstLine;
-            if (!getline(cin, firstLine)) break;
-            if (firstLine.empty()) continue;
-            if (firstLine[0] == '-') {
-                RoundConfig rc;
-                string tmp;
-                cin >> tmp >> rc.waveNumber;
-                cin >> tmp >> rc.randomKoopas;
-                cin >> tmp >> rc.namedKoopas;
-                cin.ignore(numeric_limits<streamsize>::max(), '\n');
-                for (uint32_t i = 0; i < rc.namedKoopas; i++) {
-                    if (!getline(cin, firstLine)) break;
-                    rc.koopaLines.push_back(firstLine);
+        if (hit != n) {
+            // Slots are not in spawn order; the first breacher is the
+            // earliest-spawned Koopa at the castle.
+            size_t breacher = hit;
+            for (size_t i = hit + 1; i < n; i++) {
+                if (active.distance[i] == 0 &&
+                    active.id[i] < active.id[breacher]) {
+                    breacher = i;
                 }
-                waveConfigs.push_back(rc);
+            }
+            gameOver = true;
+            if (trace) trace->breach(active.id[breacher]);
+            out << "DEFEAT IN ROUND " << currentRound << "! "
+                << nameOf(active.record[breacher]) << " reached the castle!\n";
+            if (features.stats()) {
+                printStats();
             }
         }
-        sort(waveConfigs.begin(), waveConfigs.end(),
-             [](const RoundConfig &a, const RoundConfig &b){
-                 return a.waveNumber < b.waveNumber;
-             });
-        currentWaveIndex = 0;
-        if (!waveConfigs.empty()) {
-            nextWaveNumber = waveConfigs[0].waveNumber;
+    }
+
+    // nameId: the generator index of a random Koopa, which then has no
+    // name of its own, else KoopaTombstones::NAMED.
+    void addKoopa(string_view nm, uint64_t nameId, uint32_t dist, uint32_t sp,
+                  uint32_t hp) {
+        Koopa *k = koopaArena.create(nm, nameId, currentRound, koopaCounter++);
+        active.add(k, dist, sp, hp, currentRound);
+        activeKoopaCount++;
+        if (trace) trace->spawn(nameOf(k), dist, sp, hp);
+        if (features.verbose()) {
+            out << "Spawned: " << nameOf(k)
+                << " (distance: " << dist
+                << ", speed: " << sp
+                << ", health: " << hp << ")\n";
         }
     }
 
-    void moveKoopas() {
-        Koopa* castleBreacher = nullptr;
-        for (auto *k : allKoopas) {
-            if (!k->isActive) continue;
-            if (k->spawnRound >= currentRound) continue;
-            uint32_t step = min(k->distanceToCastle, k->walkSpeed);
-            k->distanceToCastle -= step;
-            if (verbose) {
-                cout << "Moved: " << k->name
-                     << " (distance: " << k->distanceToCastle
-                     << ", speed: " << k->walkSpeed
-                     << ", health: " << k->shellHP << ")\n";
-            }
-            if (k->distanceToCastle == 0 && !castleBreacher) {
-                castleBreacher = k;
-                k->knockOutRound = currentRound;
-            }
-        }
-        if (castleBreacher) {
-            gameOver = true;
-            cout << "DEFEAT IN ROUND " << currentRound << "! "
-                 << castleBreacher->name << " reached the castle!\n";
-            if (statsCount > 0) {
-                printStats();
+    // A random Koopa's name is only built when it is needed, from its
+    // generator index into `scratch`; the result lasts until the next call
+    // with the same buffer.
+    static const string &nameOf(const Koopa *k, string &scratch) {
+        if (k->nameId == KoopaTombstones::NAMED) return k->name;
+        KoopaRandomGenerator::koopaName(static_cast<uint32_t>(k->nameId),
+                                        scratch);
+        return scratch;
+    }
+
+    const string &nameOf(const Koopa *k) {
+        return nameOf(k, nameScratch);
+    }
+
+    // Compares two names as strings, random ones by koopaNameKey().
+    bool nameBefore(uint32_t a, uint32_t b) {
+        const Koopa *ka = active.record[a];
+        const Koopa *kb = active.record[b];
+        if (ka->nameId != KoopaTombstones::NAMED &&
+            kb->nameId != KoopaTombstones::NAMED) {
+            return KoopaRandomGenerator::koopaNameKey(
+                       static_cast<uint32_t>(ka->nameId)) <
+                   KoopaRandomGenerator::koopaNameKey(
+                       static_cast<uint32_t>(kb->nameId));
+        }
+        return nameOf(ka, nameScratch) < nameOf(kb, otherNameScratch);
+    }
+
+    // Rebuilds the name ranks of the active Koopas after a wave was added
+    // in slots [firstNew, size): randomCount random Koopas named from
+    // firstIndex on, then the named ones. The live Koopas are already
+    // sorted by their old rank, so only the new names are sorted, the
+    // random ones by koopaNameKey() rather than as strings, and the three
+    // runs are merged in linear time. Old Koopas keep their relative order,
+    // so rewriting their ranks leaves the heap valid. Equal names rank in
+    // spawn order. A wave drawn ahead comes with its new names sorted.
+    void rankNames(uint32_t firstNew, uint32_t randomCount,
+                   uint32_t firstIndex, const DrawnWave *drawn) {
+        const uint32_t none = numeric_limits<uint32_t>::max();
+        rankScratch.assign(rankedCount, none);
+        for (uint32_t slot = 0; slot < firstNew; slot++) {
+            rankScratch[active.key[slot].rank()] = slot;
+        }
+        rankScratch.erase(remove(rankScratch.begin(), rankScratch.end(), none),
+                          rankScratch.end());
+        size_t oldCount = rankScratch.size();
+        if (!drawn) {
+            nameKeys.resize(randomCount);
+            for (uint32_t i = 0; i < randomCount; i++) {
+                nameKeys[i] = KoopaRandomGenerator::koopaNameKey(firstIndex + i);
             }
+            sort(nameKeys.begin(), nameKeys.end());
         }
+        for (uint64_t k : drawn ? drawn->nameKeys : nameKeys) {
+            rankScratch.push_back(firstNew +
+                (KoopaRandomGenerator::koopaNameIndex(k) - firstIndex));
+        }
+        size_t namedBegin = rankScratch.size();
+        uint32_t firstNamed = firstNew + randomCount;
+        auto byName = [this](uint32_t a, uint32_t b) {
+            return nameBefore(a, b);
+        };
+        if (drawn) {
+            for (uint32_t i : drawn->namedByName) {
+                rankScratch.push_back(firstNamed + i);
+            }
+        } else {
+            for (uint32_t slot = firstNamed; slot < active.size(); slot++) {
+                rankScratch.push_back(slot);
+            }
+            stable_sort(rankScratch.begin() +
+                            static_cast<ptrdiff_t>(namedBegin),
+                        rankScratch.end(), byName);
+        }
+        inplace_merge(rankScratch.begin() + static_cast<ptrdiff_t>(oldCount),
+                      rankScratch.begin() + static_cast<ptrdiff_t>(namedBegin),
+                      rankScratch.end(), byName);
+        rankMerged.resize(rankScratch.size());
+        merge(rankScratch.begin(),
+              rankScratch.begin() + static_cast<ptrdiff_t>(oldCount),
+              rankScratch.begin() + static_cast<ptrdiff_t>(oldCount),
+              rankScratch.end(), rankMerged.begin(), byName);
+        for (size_t r = 0; r < rankMerged.size(); r++) {
+            active.key[rankMerged[r]].setRank(static_cast<uint32_t>(r));
+        }
+        rankedCount = static_cast<uint32_t>(rankMerged.size());
     }
 
-    void spawnKoopas(uint32_t randomCount, const vector<string> &lines) {
+    // With `drawn` the random Koopas come from it instead of the generator.
+    void spawnKoopas(uint32_t randomCount, const vector<NamedKoopa> &named,
+                     const DrawnWave *drawn = nullptr) {
+        PhaseScope timer(profiler.get(), PhaseProfiler::SPAWN);
+        uint32_t firstNew = static_cast<uint32_t>(active.size());
+        size_t count = randomCount + named.size();
+        active.reserve(active.size() + count);
+        const uint32_t *dist, *sp, *hp;
+        uint32_t first;
+        if (drawn) {
+            first = drawn->first;
+            dist = drawn->distance.data();
+            sp = drawn->speed.data();
+            hp = drawn->health.data();
+        } else if (randomPool) {
+            first = static_cast<uint32_t>(randomPoolNext);
+            dist = randomPool->distance.data() + randomPoolNext;
+            sp = randomPool->speed.data() + randomPoolNext;
+            hp = randomPool->health.data() + randomPoolNext;
+            randomPoolNext += randomCount;
+        } else {
+            randDistance.resize(randomCount);
+            randSpeed.resize(randomCount);
+            randHealth.resize(randomCount);
+            first = rng.generateKoopas(randomCount, randDistance.data(),
+                                       randSpeed.data(), randHealth.data(),
+                                       generatorThreads);
+            dist = randDistance.data();
+            sp = randSpeed.data();
+            hp = randHealth.data();
+        }
         for (uint32_t i = 0; i < randomCount; i++) {
-            string nm = KoopaRandomGenerator::getNextKoopaName();
-            uint32_t dist = KoopaRandomGenerator::getNextKoopaDistance();
-            uint32_t sp   = KoopaRandomGenerator::getNextKoopaSpeed();
-            uint32_t hp   = KoopaRandomGenerator::getNextKoopaHealth();
-            Koopa *k = new Koopa(nm, dist, sp, hp, currentRound, koopaCounter++);
-            allKoopas.push_back(k);
-            activeKoopaCount++;
-            targetQueue.push(k);
-            if (verbose) {
-                cout << "Spawned: " << nm
-                     << " (distance: " << dist
-                     << ", speed: " << sp
-                     << ", health: " << hp << ")\n";
-            }
-        }
-        for (auto &ln : lines) {
-            istringstream iss(ln);
-            string nm; iss >> nm;
-            uint32_t dist=0, sp=0, hp=0;
-            string d;
-            iss >> d >> dist >> d >> sp >> d >> hp;
-            Koopa *k = new Koopa(nm, dist, sp, hp, currentRound, koopaCounter++);
-            allKoopas.push_back(k);
-            activeKoopaCount++;
-            targetQueue.push(k);
-            if (verbose) {
-                cout << "Spawned: " << nm
-                     << " (distance: " << dist
-                     << ", speed: " << sp
-                     << ", health: " << hp << ")\n";
-            }
-        }
-    }
-
-    void throwRocks() {
+            addKoopa(string_view(), first + i, dist[i], sp[i], hp[i]);
+        }
+        for (const NamedKoopa &nk : named) {
+            addKoopa(nk.name, KoopaTombstones::NAMED, nk.distance, nk.speed,
+                     nk.health);
+        }
+        rankNames(firstNew, randomCount, first, drawn);
+        // A Koopa spawned without health can never be knocked out; it just
+        // walks until it reaches the castle.
+        spawnTargets.clear();
+        for (uint32_t slot = firstNew; slot < active.size(); slot++) {
+            if (active.health[slot] > 0) {
+                spawnTargets.push_back(slot);
+            }
+        }
+        targetQueue.pushAll(spawnTargets.data(), spawnTargets.size());
+        if (profiler) {
+            profiler->count(PhaseProfiler::HEAP_PUSHES, spawnTargets.size());
+        }
+    }
+
+    // Returns the rocks left over.
+    uint32_t throwRocks() {
+        PhaseScope timer(profiler.get(), PhaseProfiler::THROW);
         uint32_t rocks = bagCapacity;
-        while (rocks > 0) {
-            while (!targetQueue.empty() &&
-                   (!targetQueue.top()->isActive ||
-                    targetQueue.top()->shellHP == 0)) {
+        uint64_t pops = 0, keyUpdates = 0;
+        while (rocks > 0 && !targetQueue.empty()) {
+            // Each rock only lowers the top Koopa's health, which raises its
+            // priority, so it keeps taking rocks until it is knocked out or
+            // the bag is empty. Spend them all in one step. The order is
+            // total (see PriorityKey), so this hits the Koopas a pop and a
+            // re-push per rock would. The original std::priority_queue
+            // broke full ties by its internal layout instead, so with
+            // repeated names the verbose log can differ from it.
+            uint32_t slot = targetQueue.top();
+            KoopaId id = active.id[slot];
+            uint32_t spent = min(rocks, active.health[slot]);
+            active.health[slot] -= spent;
+            active.key[slot].loseHealth(spent);
+            rocks -= spent;
+            if (active.health[slot] > 0) {
+                targetQueue.decreaseKey(slot);
+                keyUpdates++;
+                if (trace) trace->damage(id, spent);
+            } else {
                 targetQueue.pop();
-            }
-            if (targetQueue.empty()) break;
-
-            Koopa *k = targetQueue.top();
-            targetQueue.pop();
-            if (!k->isActive || k->shellHP == 0) continue;
-            k->shellHP--;
-            rocks--;
-            if (k->shellHP == 0) {
-                k->isActive = false;
-                k->knockOutRound = currentRound;
-                k->knockOutOrder = ++knockOutCounter;
+                pops++;
+                Koopa *k = active.record[slot];
+                knockOutCounter = tombstones.add(*k, currentRound);
+                lastKnockedOut = id;
                 activeKoopaCount--;
-                if (verbose) {
-                    cout << "Knocked Out: " << k->name
-                         << " (distance: " << k->distanceToCastle
-                         << ", speed: " << k->walkSpeed
-                         << ", health: " << k->shellHP << ")\n";
+                if (trace) trace->knockOut(id);
+                if (features.verbose()) {
+                    out << "Knocked Out: " << nameOf(k)
+                        << " (distance: " << active.distance[slot]
+                        << ", speed: " << active.speed[slot]
+                        << ", health: " << active.health[slot] << ")\n";
                 }
-                if (trackMedian) {
-                    uint32_t life = k->getActiveRounds(currentRound);
-                    medianTracker.add(life);
+                uint32_t moved = active.remove(slot);
+                if (moved != slot) {
+                    targetQueue.rename(moved, slot);
                 }
+                if (features.lifetimes()) {
+                    medianTracker.add(getActiveRounds(k));
+                }
+                if (features.stats()) {
+                    uint32_t life = getActiveRounds(k);
+                    const string &name = nameOf(k);
+                    knockOutLog.record(name);
+                    mostActiveOut.offer(life, name);
+                    leastActiveOut.offer(life, name);
+                }
+                koopaArena.destroy(k);
             }
-            else {
-                targetQueue.push(k);
-            }
         }
+        if (profiler) {
+            profiler->count(PhaseProfiler::HEAP_POPS, pops);
+            profiler->count(PhaseProfiler::KEY_UPDATES, keyUpdates);
+            profiler->count(PhaseProfiler::ROCKS, bagCapacity - rocks);
+        }
+        return rocks;
+    }
+
+    // The --median and --percentiles lines at the end of a round.
+    void printLifetimes() {
+        if (!features.lifetimes()) return;
+        PhaseScope timer(profiler.get(), PhaseProfiler::LIFETIMES);
         if (trackMedian && !medianTracker.empty()) {
-            cout << "At the end of round " << currentRound
-                 << ", the median Koopa active-time is "
-                 << medianTracker.getMedian() << "\n";
+            out << "At the end of round " << currentRound
+                << ", the median Koopa active-time is "
+                << medianTracker.getMedian() << "\n";
+        }
+        if (!percentiles.empty() && !medianTracker.empty()) {
+            out << "At the end of round " << currentRound
+                << ", the Koopa active-time percentiles are ";
+            for (size_t i = 0; i < percentiles.size(); i++) {
+                out << (i ? ", " : "") << percentiles[i].label << ": "
+                    << medianTracker.getPercentile(percentiles[i].milli);
+            }
+            out << "\n";
+        }
+    }
+
+    // Moves until the Koopa in `slot` reaches the castle: it breaches on the
+    // move that takes its distance to 0. None for a Koopa that never moves.
+    uint64_t movesToCastle(size_t slot) const {
+        uint64_t d = active.distance[slot], sp = active.speed[slot];
+        if (d == 0) return 1;
+        if (sp == 0) return numeric_limits<uint64_t>::max();
+        return (d + sp - 1) / sp;
+    }
+
+    // True if `health` is more than the bag can throw in `rounds` rounds.
+    bool beyondBag(uint64_t health, uint64_t rounds) const {
+        if (health == 0) return false;
+        if (bagCapacity == 0) return true;
+        return (health - 1) / bagCapacity >= rounds;
+    }
+
+    // Settles the game at the end of a round if the rest of it can only go
+    // one way, whatever order the rocks are thrown in. A Koopa m moves from
+    // the castle can only be hit in the m - 1 rounds before it breaches, so
+    // if the Koopas due within m moves carry more health than that many
+    // bags, one of them gets through. Once every wave is out, if all the
+    // health left fits in the bags before the first Koopa is due, the game
+    // is won. A Koopa without health can never be knocked out.
+    //
+    // Health is bucketed by moves to the castle, so the check is linear in
+    // the active Koopas; only the next DUE_HORIZON moves are checked.
+    bool outcomeDecided() {
+        const uint64_t DUE_HORIZON = 4096;
+        healthDue.assign(DUE_HORIZON + 1, 0);
+        uint64_t totalHealth = 0;
+        uint64_t firstDue = numeric_limits<uint64_t>::max();
+        for (size_t slot = 0; slot < active.size(); slot++) {
+            uint32_t hp = active.health[slot];
+            uint64_t due = movesToCastle(slot);
+            if (hp == 0) {
+                gameOver = true;
+                return true;
+            }
+            totalHealth += hp;
+            firstDue = min(firstDue, due);
+            if (due <= DUE_HORIZON) healthDue[due] += hp;
+        }
+        uint64_t demand = 0;
+        for (uint64_t due = 1; due <= DUE_HORIZON; due++) {
+            demand += healthDue[due];
+            if (beyondBag(demand, due - 1)) {
+                gameOver = true;
+                return true;
+            }
+        }
+        if (!pendingWave &&
+            !beyondBag(totalHealth, firstDue - 1)) {
+            gameOver = true;
+            victory = true;
+            return true;
+        }
+        return false;
+    }
+
+    void recordMargin(uint32_t spareRocks) {
+        uint64_t nearest = 0;
+        for (size_t slot = 0; slot < active.size(); slot++) {
+            uint64_t due = movesToCastle(slot);
+            if (nearest == 0 || due < nearest) nearest = due;
         }
+        margins->push_back({ currentRound, spareRocks,
+                             static_cast<uint32_t>(min<uint64_t>(
+                                 nearest, numeric_limits<uint32_t>::max())) });
     }
 
     bool checkVictory() {
         if (activeKoopaCount == 0) {
-            if (currentWaveIndex >= waveConfigs.size()) {
+            if (!pendingWave) {
                 gameOver = true;
-                Koopa* lastKnocked = nullptr;
-                for (auto *k : allKoopas) {
-                    if (k->knockOutOrder > 0) {
-                        if (!lastKnocked ||
-                            k->knockOutOrder > lastKnocked->knockOutOrder) {
-                            lastKnocked = k;
-                        }
-                    }
+                victory = true;
+                if (trace) {
+                    trace->victory(knockOutCounter > 0, lastKnockedOut);
                 }
-                cout << "VICTORY IN ROUND " << currentRound << "!";
-                if (lastKnocked) {
-                    cout << " " << lastKnocked->name
-                         << " was the final Koopa.";
+                out << "VICTORY IN ROUND " << currentRound << "!";
+                if (knockOutCounter > 0) {
+                    out << " "
+                        << tombstones.name(tombstones.byOrder(knockOutCounter))
+                        << " was the final Koopa.";
                 }
-                cout << "\n";
-                if (statsCount > 0) {
+                out << "\n";
+                if (features.stats()) {
                     printStats();
                 }
                 return true;
@@ -328,131 +1254,681 @@ public:
         return false;
     }
 
+    // Appends the `limit` active Koopas that come first under `before`. An
+    // active Koopa's rounds only depend on its spawn round, so the most
+    // active are the oldest and the least active the newest: walk the spawn
+    // order from that end, taking `limit` Koopas plus any that tie with the
+    // last one taken, then keep the first `limit` of those.
+    template <typename Before>
+    void selectActive(bool newestFirst, size_t limit, Before before,
+                      vector<StatEntry> &out) const {
+        vector<StatEntry> picked;
+        string name;
+        active.walkSpawnOrder(newestFirst, [&](uint32_t slot) {
+            const Koopa *k = active.record[slot];
+            uint32_t rounds = getActiveRounds(k);
+            if (picked.size() >= limit && rounds != picked.back().rounds) {
+                return false;
+            }
+            picked.push_back({ nameOf(k, name), rounds });
+            return true;
+        });
+        size_t keep = min(limit, picked.size());
+        partial_sort(picked.begin(),
+                     picked.begin() + static_cast<ptrdiff_t>(keep),
+                     picked.end(), before);
+        out.insert(out.end(), picked.begin(),
+                   picked.begin() + static_cast<ptrdiff_t>(keep));
+    }
+
     void printStats() {
-        cout << "Koopas still active: " << activeKoopaCount << "\n";
-        vector<Koopa*> knocked;
-        for (auto *k : allKoopas) {
-            if (k->knockOutOrder != 0) {
-                knocked.push_back(k);
-            }
-        }
-        size_t c = knocked.size();
-        size_t n = min<size_t>(c, statsCount);
-
-        cout << "First Koopas knocked out:\n";
-        if (!knocked.empty()) {
-            sort(knocked.begin(), knocked.end(),
-                 [](auto a, auto b){
-                     return a->knockOutOrder < b->knockOutOrder;
-                 });
-            for (size_t i=0; i<n; i++) {
-                cout << knocked[i]->name << " " << (i+1) << "\n";
-            }
-        }
-
-        cout << "Last Koopas knocked out:\n";
-        if (!knocked.empty()) {
-            sort(knocked.begin(), knocked.end(),
-                 [](auto a, auto b){
-                     return a->knockOutOrder > b->knockOutOrder;
-                 });
-            for (size_t i=0; i<n; i++) {
-                cout << knocked[i]->name << " " << (n - i) << "\n";
-            }
-        }
-
-        uint32_t endR = currentRound;
-        vector<Koopa*> allK = allKoopas;
-        sort(allK.begin(), allK.end(),
-             [endR](auto a, auto b){
-                 uint32_t aa = a->getActiveRounds(endR);
-                 uint32_t bb = b->getActiveRounds(endR);
-                 if (aa != bb) return aa > bb;
-                 return a->name < b->name;
-             });
-        size_t tot = allK.size();
-        size_t lim = min<size_t>(tot, statsCount);
-
-        cout << "Most active Koopas:\n";
+        PhaseScope timer(profiler.get(), PhaseProfiler::STATS);
+        out << "Koopas still active: " << activeKoopaCount << "\n";
+        size_t n = knockOutLog.size();
+
+        out << "First Koopas knocked out:\n";
+        for (size_t i=0; i<n; i++) {
+            out << knockOutLog.firstOut(i) << " " << (i+1) << "\n";
+        }
+
+        out << "Last Koopas knocked out:\n";
+        for (size_t i=0; i<n; i++) {
+            out << knockOutLog.lastOut(i) << " " << (n - i) << "\n";
+        }
+
+        size_t lim = min<size_t>(koopaCounter, statsCount);
+
+        vector<StatEntry> most = mostActiveOut.entries();
+        selectActive(false, lim, MoreActive(), most);
+        sort(most.begin(), most.end(), MoreActive());
+        out << "Most active Koopas:\n";
         for (size_t i=0; i<lim; i++) {
-            cout << allK[i]->name << " "
-                 << allK[i]->getActiveRounds(endR) << "\n";
-        }
-
-        sort(allK.begin(), allK.end(),
-             [endR](auto a, auto b){
-                 uint32_t aa = a->getActiveRounds(endR);
-                 uint32_t bb = b->getActiveRounds(endR);
-                 if (aa != bb) return aa < bb;
-                 return a->name < b->name;
-             });
-        cout << "Least active Koopas:\n";
+            out << most[i].name << " " << most[i].rounds << "\n";
+        }
+
+        vector<StatEntry> least = leastActiveOut.entries();
+        selectActive(true, lim, LessActive(), least);
+        sort(least.begin(), least.end(), LessActive());
+        out << "Least active Koopas:\n";
         for (size_t i=0; i<lim; i++) {
-            cout << allK[i]->name << " "
-                 << allK[i]->getActiveRounds(endR) << "\n";
+            out << least[i].name << " " << least[i].rounds << "\n";
+        }
+    }
+
+    // Everything the rest of the game depends on. Waves are not saved: they
+    // are read again from the scenario, which is identified by its hash.
+    void saveState(SnapshotWriter &w) const {
+        w.put(scenarioHash);
+        w.put(statsCount);
+        w.put(features.lifetimes());
+        w.put(currentRound);
+        w.put(currentWaveIndex);
+        w.put(rankedCount);
+        w.put(activeKoopaCount);
+        w.put(knockOutCounter);
+        w.put(lastKnockedOut);
+
+        KoopaRandomGenerator::State gen = rng.saveState();
+        w.put(gen.genState);
+        w.put(gen.koopaCounter);
+        w.put(gen.maxRandDist);
+        w.put(gen.maxRandSpeed);
+        w.put(gen.maxRandHealth);
+        w.put(gen.mti);
+        w.put(gen.mt.size());
+        for (uint32_t word : gen.mt) w.put(word);
+
+        w.put(koopaCounter);
+        tombstones.save(w);
+        active.save(w);
+        for (const Koopa *k : active.record) {
+            w.putString(k->name);
+            w.put(k->nameId);
+            w.put(k->spawnRound);
+        }
+        const vector<uint32_t> &heap = targetQueue.items();
+        w.put(heap.size());
+        for (uint32_t slot : heap) w.put(slot);
+
+        const vector<uint64_t> &nodes = medianTracker.nodes();
+        w.put(nodes.size());
+        for (uint64_t node : nodes) w.put(node);
+        knockOutLog.save(w);
+        mostActiveOut.save(w);
+        leastActiveOut.save(w);
+    }
+
+    void loadState(SnapshotReader &r) {
+        if (r.get() != scenarioHash) {
+            cerr << "Checkpoint " << resumePath
+                 << " was taken from a different scenario\n";
+            exit(1);
+        }
+        if (r.get() != statsCount || r.get() != features.lifetimes()) {
+            cerr << "Checkpoint " << resumePath << " needs the same"
+                 << " --statistics and --median/--percentiles options\n";
+            exit(1);
+        }
+        currentRound = r.get32();
+        currentWaveIndex = r.get32();
+        rankedCount = r.get32();
+        activeKoopaCount = r.get32();
+        knockOutCounter = r.get32();
+        lastKnockedOut = r.get32();
+        for (size_t i = 0; i < currentWaveIndex; i++) {
+            if (!pendingWave) r.fail();
+            pendingWave = waveSource->next();
+        }
+
+        KoopaRandomGenerator::State gen;
+        gen.genState = r.get32();
+        gen.koopaCounter = r.get32();
+        gen.maxRandDist = r.get32();
+        gen.maxRandSpeed = r.get32();
+        gen.maxRandHealth = r.get32();
+        gen.mti = r.get32();
+        gen.mt.resize(r.getCount());
+        for (uint32_t &word : gen.mt) word = r.get32();
+        if (!rng.restoreState(gen)) r.fail();
+
+        koopaCounter = r.get32();
+        tombstones.load(r);
+        if (tombstones.size() != knockOutCounter ||
+            (knockOutCounter > 0 && lastKnockedOut >= koopaCounter)) {
+            r.fail();
         }
+        active.load(r, koopaCounter);
+        for (size_t slot = 0; slot < active.size(); slot++) {
+            string name = r.getString();
+            uint64_t nameId = r.get();
+            uint32_t spawnRound = r.get32();
+            if (nameId > UINT32_MAX && nameId != KoopaTombstones::NAMED) {
+                r.fail();
+            }
+            active.record[slot] = koopaArena.create(name, nameId, spawnRound,
+                                                    active.id[slot]);
+        }
+        vector<uint32_t> heap(r.getCount());
+        for (uint32_t &slot : heap) {
+            slot = r.get32();
+            if (slot >= active.size()) r.fail();
+        }
+        if (!targetQueue.restore(heap)) r.fail();
+
+        vector<uint64_t> nodes(r.getCount());
+        for (uint64_t &node : nodes) node = r.get();
+        if (!medianTracker.restore(nodes)) r.fail();
+        knockOutLog.load(r);
+        mostActiveOut.load(r);
+        leastActiveOut.load(r);
+        if (!r.atEnd() || activeKoopaCount != active.size()) r.fail();
+    }
+
+    void writeCheckpoint() {
+        // Whatever the game printed up to here belongs before the
+        // checkpoint, so a resumed run can simply append to it.
+        PhaseScope timer(profiler.get(), PhaseProfiler::CHECKPOINT);
+        out.flush();
+        SnapshotWriter w;
+        saveState(w);
+        w.writeFile(checkpointPath);
     }
 
     void runSimulation() {
-        readHeader();
-        readWaves();
+        if (streamInput) {
+            ScenarioHeader header;
+            unique_ptr<WaveSource> waves = openWaveStream(STDIN_FILENO, header);
+            if (parseAhead) {
+                waves.reset(new ParseAheadWaves(std::move(waves), header,
+                                                generatorThreads));
+            }
+            play(header, *waves);
+            return;
+        }
+        InputBuffer input(STDIN_FILENO);
+        run(input.begin(), input.end());
+    }
+
+    // Plays the scenario held in [begin, end), which must outlive the call.
+    void run(const char *begin, const char *end) {
+        ScenarioParser parser(begin, end);
+        ScenarioHeader header = parser.readHeader();
+        readWaves(parser, ownWaves);
+        if (checkpointEvery > 0 || !resumePath.empty()) {
+            scenarioHash = snapshotHash(begin, end);
+        }
+        play(header, ownWaves);
+    }
+
+    // Plays waves already sorted by readWaves(). They are only read, so
+    // many games can share one copy.
+    void play(const ScenarioHeader &header, const vector<RoundConfig> &waves) {
+        WaveList list(waves);
+        play(header, list);
+    }
+
+    // Plays the waves of `waves`, taking the next one only once the wave
+    // before it has spawned.
+    void play(const ScenarioHeader &header, WaveSource &waves) {
+        bagCapacity = header.bagCapacity;
+        rng.initialize(header.seed, header.maxDistance,
+                       header.maxSpeed, header.maxHealth);
+        waveSource = &waves;
+        currentWaveIndex = 0;
+        pendingWave = waves.next();
         currentRound = 0;
+        if (!resumePath.empty()) {
+            SnapshotReader r(resumePath);
+            loadState(r);
+        }
         while (!gameOver) {
             currentRound++;
-            if (verbose) {
-                cout << "Round: " << currentRound << "\n";
+            if (trace) trace->beginRound(currentRound);
+            if (profiler) profiler->beginRound(currentRound);
+            if (features.verbose()) {
+                out << "Round: " << currentRound << "\n";
             }
             moveKoopas();
             if (gameOver) break;
 
-            if (currentWaveIndex < waveConfigs.size() &&
-                currentRound == nextWaveNumber) {
-                auto &cfg = waveConfigs[currentWaveIndex];
-                spawnKoopas(cfg.randomKoopas, cfg.koopaLines);
+            bool spawned = false;
+            if (pendingWave && currentRound == pendingWave->waveNumber) {
+                spawned = true;
+                spawnKoopas(pendingWave->randomKoopas, pendingWave->koopas,
+                            waves.drawn());
                 currentWaveIndex++;
-                if (currentWaveIndex < waveConfigs.size()) {
-                    nextWaveNumber = waveConfigs[currentWaveIndex].waveNumber;
-                } else {
-                    nextWaveNumber = numeric_limits<uint32_t>::max();
-                }
+                pendingWave = waves.next();
             }
-            throwRocks();
+            uint32_t spareRocks = throwRocks();
+            printLifetimes();
             if (gameOver) break;
+            if (margins) recordMargin(spareRocks);
             if (checkVictory()) break;
+            if (decideEarly && spawned && outcomeDecided()) break;
+            if (checkpointEvery > 0 && currentRound % checkpointEvery == 0) {
+                writeCheckpoint();
+            }
+        }
+        if (trace) trace->finish();
+        if (profiler) {
+            profiler->endRound();
+            out.flush();
+            profiler->printSummary(cerr);
         }
     }
 };
 
+// Parses an inclusive seed range "A..B".
+bool parseSeedRange(const string &spec, uint32_t &first, uint32_t &last) {
+    size_t dots = spec.find("..");
+    if (dots == string::npos || dots == 0 || dots + 2 == spec.size()) {
+        return false;
+    }
+    const char *b = spec.data(), *e = b + spec.size();
+    auto r1 = from_chars(b, b + dots, first);
+    auto r2 = from_chars(b + dots + 2, e, last);
+    return r1.ec == errc() && r1.ptr == b + dots &&
+           r2.ec == errc() && r2.ptr == e && first <= last;
+}
+
+// Prints "part (xx.xx%)" with integer rounding, so the text does not
+// depend on floating-point formatting.
+void printShare(OutputWriter &out, uint64_t part, uint64_t whole) {
+    uint64_t bp = whole == 0 ? 0 : (part * 20000 + whole) / (2 * whole);
+    out << part << " (" << bp / 100 << '.'
+        << static_cast<char>('0' + bp / 10 % 10)
+        << static_cast<char>('0' + bp % 10) << "%)\n";
+}
+
+// Outcomes of a batch of games. Only counts are kept, so merging tallies
+// gives the same totals in any order.
+struct SweepTally {
+    uint64_t games = 0;
+    uint64_t victories = 0;
+    map<uint32_t, uint64_t> endRounds;        // round -> games
+    map<uint32_t, uint64_t> medianLifetimes;  // lifetime -> games
+
+    void add(const GameResult &r) {
+        games++;
+        victories += r.victory;
+        endRounds[r.endRound]++;
+        if (r.knockedOut > 0) medianLifetimes[r.medianLifetime]++;
+    }
+
+    void merge(const SweepTally &other) {
+        games += other.games;
+        victories += other.victories;
+        for (const auto &e : other.endRounds) endRounds[e.first] += e.second;
+        for (const auto &e : other.medianLifetimes) {
+            medianLifetimes[e.first] += e.second;
+        }
+    }
+};
+
+// Prints nearest-rank quantiles of a value -> count histogram.
+void printDistribution(OutputWriter &out, const char *label,
+                       const map<uint32_t, uint64_t> &counts) {
+    out << label << ":";
+    if (counts.empty()) {
+        out << " none\n";
+        return;
+    }
+    uint64_t total = 0;
+    for (const auto &e : counts) total += e.second;
+    static const uint32_t pcts[] = { 10, 25, 50, 75, 90, 99 };
+    out << " min " << counts.begin()->first;
+    auto it = counts.begin();
+    uint64_t below = 0;
+    for (uint32_t p : pcts) {
+        uint64_t rank = (p * total + 99) / 100;
+        if (rank == 0) rank = 1;
+        while (below + it->second < rank) {
+            below += it->second;
+            ++it;
+        }
+        out << ", p" << p << " " << it->first;
+    }
+    out << ", max " << counts.rbegin()->first << "\n";
+}
+
+// Plays the scenario on stdin once per seed in [first, last] and prints
+// the aggregate. Waves are parsed once and shared by all games. Each
+// thread tallies its own games and the tallies are merged at the end;
+// they hold only counts, so the output does not depend on the number of
+// threads or on which thread played which seed.
+int runSweep(uint32_t first, uint32_t last, unsigned threads) {
+    InputBuffer input(STDIN_FILENO);
+    ScenarioParser parser(input.begin(), input.end());
+    ScenarioHeader header = parser.readHeader();
+    vector<RoundConfig> waves;
+    readWaves(parser, waves);
+
+    uint64_t games = static_cast<uint64_t>(last) - first + 1;
+    vector<SweepTally> tallies(max(1u, threads));
+    parallelFor(first, static_cast<uint64_t>(last) + 1, threads,
+                [&](unsigned worker, uint64_t seed) {
+        ScenarioHeader h = header;
+        h.seed = static_cast<uint32_t>(seed);
+        MarioCastleDefense<DynamicFeatures> game(false, false, 0,
+                                                 vector<Percentile>(), -1);
+        game.keepLifetimes();
+        game.play(h, waves);
+        tallies[worker].add(game.result());
+    });
+
+    SweepTally total;
+    for (const SweepTally &t : tallies) total.merge(t);
+
+    OutputWriter out;
+    out << "Seeds " << first << ".." << last << ": " << games << " games\n";
+    out << "Victories: ";
+    printShare(out, total.victories, games);
+    out << "Defeats: ";
+    printShare(out, games - total.victories, games);
+    printDistribution(out, "Ending round", total.endRounds);
+    printDistribution(out, "Median knock-out lifetime", total.medianLifetimes);
+    return 0;
+}
+
+// Finds the smallest Bag-Capacity that wins the scenario on stdin, assuming
+// that a bigger bag never loses a game a smaller one wins. The waves are
+// parsed and the random Koopas drawn once for all trials, and each trial
+// stops as soon as its outcome is certain. Capacities are tried `threads`
+// at a time: first 0, 1, 3, 7, ... until one wins, then `threads` points
+// spread over the remaining gap, which shrinks it (threads + 1)-fold per
+// step. The winning game is then replayed in full for its margins.
+int runCapacitySolve(unsigned threads) {
+    InputBuffer input(STDIN_FILENO);
+    ScenarioParser parser(input.begin(), input.end());
+    ScenarioHeader header = parser.readHeader();
+    vector<RoundConfig> waves;
+    readWaves(parser, waves);
+    RandomKoopaPool pool;
+    pool.generate(header, waves, threads);
+
+    // A bag that holds a whole wave's health knocks every Koopa out in the
+    // round it spawns; if that loses, every capacity does.
+    uint64_t mostHealth = 0;
+    size_t next = 0;
+    for (const RoundConfig &w : waves) {
+        uint64_t sum = 0;
+        for (uint32_t i = 0; i < w.randomKoopas; i++) sum += pool.health[next++];
+        for (const NamedKoopa &nk : w.koopas) sum += nk.health;
+        mostHealth = max(mostHealth, sum);
+    }
+    uint32_t upper = static_cast<uint32_t>(
+        min<uint64_t>(mostHealth, numeric_limits<uint32_t>::max()));
+
+    vector<uint32_t> batch;
+    vector<char> won;
+    auto tryAll = [&]() {
+        won.assign(batch.size(), 0);
+        parallelFor(0, batch.size(), threads, [&](unsigned, uint64_t i) {
+            ScenarioHeader h = header;
+            h.bagCapacity = batch[i];
+            MarioCastleDefense<QuietFeatures> game(false, false, 0,
+                                                   vector<Percentile>(), -1);
+            game.useRandomKoopas(&pool);
+            game.decideOutcomeEarly();
+            game.play(h, waves);
+            won[i] = game.result().victory;
+        });
+    };
+
+    OutputWriter out;
+    batch.assign(1, upper);
+    tryAll();
+    if (!won[0]) {
+        out << "No Bag-Capacity wins this scenario.\n";
+        return 0;
+    }
+
+    // Invariant: hi wins and, unless lo is -1, lo loses.
+    int64_t lo = -1;
+    int64_t hi = upper;
+    bool galloping = true;
+    unsigned gallop = 0;
+    while (hi - lo > 1) {
+        batch.clear();
+        if (galloping) {
+            for (unsigned i = 0; i < threads && gallop < 32; i++, gallop++) {
+                int64_t c = (int64_t(1) << gallop) - 1;
+                if (c >= hi) break;
+                batch.push_back(static_cast<uint32_t>(c));
+            }
+            if (batch.empty()) {
+                galloping = false;
+                continue;
+            }
+        } else {
+            int64_t points = min<int64_t>(threads, hi - lo - 1);
+            for (int64_t j = 1; j <= points; j++) {
+                batch.push_back(static_cast<uint32_t>(
+                    lo + j * (hi - lo) / (points + 1)));
+            }
+        }
+        tryAll();
+        // The batch is ascending: the first win bounds it from above, and
+        // the last loss below that from below.
+        for (size_t i = 0; i < batch.size(); i++) {
+            if (won[i]) {
+                hi = batch[i];
+                galloping = false;
+                break;
+            }
+            lo = batch[i];
+        }
+    }
+
+    uint32_t best = static_cast<uint32_t>(hi);
+    ScenarioHeader h = header;
+    h.bagCapacity = best;
+    vector<RoundMargin> margins;
+    MarioCastleDefense<QuietFeatures> game(false, false, 0,
+                                           vector<Percentile>(), -1);
+    game.useRandomKoopas(&pool);
+    game.recordMargins(margins);
+    game.play(h, waves);
+
+    out << "Minimum Bag-Capacity: " << best << "\n";
+    out << "Capacity " << best << " wins in round " << game.result().endRound;
+    if (best > 0) out << "; capacity " << best - 1 << " loses";
+    out << "\n";
+    out << "Margin by round (rocks to spare, moves until the nearest"
+        << " Koopa reaches the castle):\n";
+    for (const RoundMargin &m : margins) {
+        out << "Round " << m.round << ": " << m.spareRocks << " spare, ";
+        if (m.nearestMoves == 0) {
+            out << "no Koopas left\n";
+        } else {
+            out << "nearest " << m.nearestMoves << "\n";
+        }
+    }
+    return 0;
+}
+
+// bench/engine_bench.cpp compiles the engine in without this main.
+#ifndef MARIO_DEFENSE_NO_MAIN
+
 int main(int argc, char* argv[]){
     ios::sync_with_stdio(false);
     cin.tie(nullptr);
 
     bool v=false, m=false;
     uint32_t s=0;
+    vector<Percentile> pct;
+    const char *tracePath = nullptr;
+    const char *resumePath = nullptr;
+    string checkpointPath = "mario_defense.ckpt";
+    uint32_t checkpointEvery = 0;
+    bool sweep = false;
+    uint32_t sweepFirst = 0, sweepLast = 0;
+    bool solveCapacity = false;
+    bool profile = false;
+    bool streamInput = false;
+    bool parseAhead = false;
+    const char *profileTracePath = nullptr;
+    unsigned threads = max(1u, thread::hardware_concurrency());
 
     static struct option longOpts[] = {
         {"verbose",    no_argument,       nullptr, 'v'},
         {"median",     no_argument,       nullptr, 'm'},
         {"statistics", required_argument, nullptr, 's'},
+        {"percentiles", required_argument, nullptr, 'p'},
+        {"trace",      required_argument, nullptr, 't'},
+        {"checkpoint-every", required_argument, nullptr, 'c'},
+        {"checkpoint-file",  required_argument, nullptr, 'C'},
+        {"resume",     required_argument, nullptr, 'r'},
+        {"sweep-seeds", required_argument, nullptr, 'S'},
+        {"threads",    required_argument, nullptr, 'j'},
+        {"solve-capacity", no_argument,   nullptr, 'b'},
+        {"profile",    no_argument,       nullptr, 'P'},
+        {"profile-trace", required_argument, nullptr, 'T'},
+        {"stream-waves", no_argument,     nullptr, 'w'},
+        {"parse-ahead", no_argument,      nullptr, 'a'},
         {"help",       no_argument,       nullptr, 'h'},
         {nullptr, 0, nullptr, 0}
     };
 
     int opt, idx;
-    while ((opt = getopt_long(argc, argv, "vms:h", longOpts, &idx)) != -1) {
+    while ((opt = getopt_long(argc, argv, "vms:p:t:c:C:r:S:j:bPT:wah", longOpts, &idx)) != -1) {
         switch(opt) {
             case 'v': v=true; break;
             case 'm': m=true; break;
             case 's':
                 s = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
                 break;
+            case 'p':
+                if (!parsePercentiles(optarg, pct)) {
+                    cerr << "Invalid --percentiles list: " << optarg << "\n";
+                    return 1;
+                }
+                break;
+            case 't': tracePath = optarg; break;
+            case 'c':
+                checkpointEvery = static_cast<uint32_t>(strtoul(optarg, nullptr, 10));
+                break;
+            case 'C': checkpointPath = optarg; break;
+            case 'r': resumePath = optarg; break;
+            case 'S':
+                if (!parseSeedRange(optarg, sweepFirst, sweepLast)) {
+                    cerr << "Invalid --sweep-seeds range: " << optarg << "\n";
+                    return 1;
+                }
+                sweep = true;
+                break;
+            case 'j':
+                threads = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+                if (threads == 0) threads = 1;
+                break;
+            case 'b': solveCapacity = true; break;
+            case 'P': profile = true; break;
+            case 'w': streamInput = true; break;
+            case 'a':
+                streamInput = true;
+                parseAhead = true;
+                break;
+            case 'T':
+                profile = true;
+                profileTracePath = optarg;
+                break;
             case 'h':
                 cout << "Usage: ./mario_defense [--verbose|-v] [--median|-m]"
-                     << " [--statistics N|-s N] [--help|-h]\n";
+                     << " [--statistics N|-s N]"
+                     << " [--percentiles p50,p90,...|-p LIST]"
+                     << " [--trace FILE|-t FILE]"
+                     << " [--checkpoint-every N|-c N] [--checkpoint-file FILE|-C FILE]"
+                     << " [--resume FILE|-r FILE]"
+                     << " [--sweep-seeds A..B|-S A..B] [--solve-capacity|-b]"
+                     << " [--threads N|-j N]"
+                     << " [--profile|-P] [--profile-trace FILE|-T FILE]"
+                     << " [--stream-waves|-w] [--parse-ahead|-a]"
+                     << " [--help|-h]\n";
                 return 0;
         }
     }
-    MarioCastleDefense game(v, m, s);
-    game.runSimulation();
-    return 0;
+    if (sweep || solveCapacity) {
+        if (sweep && solveCapacity) {
+            cerr << "--sweep-seeds and --solve-capacity are separate modes\n";
+            return 1;
+        }
+        if (tracePath || resumePath || checkpointEvery > 0 || profile ||
+            streamInput) {
+            cerr << (sweep ? "--sweep-seeds" : "--solve-capacity")
+                 << " cannot be combined with --trace, --resume,"
+                 << " --checkpoint-every, --profile, --stream-waves"
+                 << " or --parse-ahead\n";
+            return 1;
+        }
+        try {
+            return sweep ? runSweep(sweepFirst, sweepLast, threads)
+                         : runCapacitySolve(threads);
+        } catch (const KoopaGeneratorError &e) {
+            cerr << e.what() << "\n";
+            return 1;
+        }
+    }
+    if (streamInput && (resumePath || checkpointEvery > 0)) {
+        // Checkpoints identify their scenario by a hash of the whole input.
+        cerr << (parseAhead ? "--parse-ahead" : "--stream-waves")
+             << " cannot be combined with --resume or --checkpoint-every\n";
+        return 1;
+    }
+    if (tracePath && resumePath) {
+        cerr << "--trace records a whole game and cannot be combined"
+             << " with --resume\n";
+        return 1;
+    }
+    auto run = [&](auto &game) -> int {
+        game.generateWith(threads);
+        if (parseAhead) {
+            game.parseWavesAhead();
+        } else if (streamInput) {
+            game.streamWaves();
+        }
+        if (checkpointEvery > 0) {
+            game.checkpointTo(checkpointPath, checkpointEvery);
+        }
+        if (resumePath) game.resumeFrom(resumePath);
+        if (tracePath) {
+            int fd = open(tracePath, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            if (fd < 0) {
+                cerr << "Cannot open trace file: " << tracePath << "\n";
+                return 1;
+            }
+            game.traceTo(fd);
+        }
+        if (profile) {
+            int fd = -1;
+            if (profileTracePath) {
+                fd = open(profileTracePath, O_WRONLY | O_CREAT | O_TRUNC,
+                          0644);
+                if (fd < 0) {
+                    cerr << "Cannot open profile trace file: "
+                         << profileTracePath << "\n";
+                    return 1;
+                }
+            }
+            game.profileTo(fd);
+        }
+        try {
+            game.runSimulation();
+        } catch (const KoopaGeneratorError &e) {
+            cerr << e.what() << "\n";
+            return 1;
+        } catch (const WaveOrderError &e) {
+            cerr << e.what() << "\n";
+            return 1;
+        }
+        return 0;
+    };
+    // Quiet games get the engine with every feature compiled out; the
+    // rest check the options at run time.
+    if (!v && s == 0 && !m && pct.empty()) {
+        MarioCastleDefense<QuietFeatures> game(v, m, s, pct);
+        return run(game);
+    }
+    MarioCastleDefense<DynamicFeatures> game(v, m, s, pct);
+    return run(game);
 }
+#endif
@@ -42,7 +42,7 @@ int runGame() {
     uint32_t seed = 12345;
     uint32_t maxDist = 700, maxSpeed = 5, maxHP = 3;
 
-    KoopaRandomGenerator::initialize(seed, maxDist, maxSpeed, maxHP);
+    KoopaRandomGenerator rng(seed, maxDist, maxSpeed, maxHP);
 
     sf::RenderWindow window(
         sf::VideoMode(sf::Vector2u(800, 600)),
@@ -63,10 +63,10 @@ int runGame() {
     size_t koopaCounter = 0;
 
     auto spawnKoopa = [&]() {
-        std::string name = KoopaRandomGenerator::getNextKoopaName();
-        uint32_t dist = KoopaRandomGenerator::getNextKoopaDistance();
-        uint32_t sp = KoopaRandomGenerator::getNextKoopaSpeed();
-        uint32_t hp = KoopaRandomGenerator::getNextKoopaHealth();
+        std::string name = rng.getNextKoopaName();
+        uint32_t dist = rng.getNextKoopaDistance();
+        uint32_t sp = rng.getNextKoopaSpeed();
+        uint32_t hp = rng.getNextKoopaHealth();
         Koopa* k = new Koopa(name, dist, sp, hp, roundCounter, koopaCounter++);
         koopas.push_back(k);
         targetQueue.push(k);
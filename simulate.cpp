@@ -14,6 +14,7 @@
 
 // Include your unchanged KoopaRandomGenerator
 #include "KoopaRandomGenerator.h"
+#include "KnockOutMedianTracker.h"
 
 // Wave config
 struct RoundConfig {
@@ -68,38 +69,6 @@ public:
     }
 };
 
-// Minimal median tracker
-class KnockOutMedianTracker {
-private:
-    std::priority_queue<uint32_t,std::vector<uint32_t>,std::less<uint32_t>> lower;
-    std::priority_queue<uint32_t,std::vector<uint32_t>,std::greater<uint32_t>> upper;
-public:
-    void add(uint32_t val){
-        if(lower.empty()||val<=lower.top()) {
-            lower.push(val);
-        } else {
-            upper.push(val);
-        }
-        if(lower.size()>upper.size()+1) {
-            upper.push(lower.top()); lower.pop();
-        } else if(upper.size()>lower.size()+1) {
-            lower.push(upper.top()); upper.pop();
-        }
-    }
-    bool empty() const { return(lower.empty() && upper.empty()); }
-    uint32_t getMedian() const {
-        if(lower.empty()&&upper.empty()) return 0;
-        if(lower.size()==upper.size()){
-            uint64_t a=lower.top(), b=upper.top();
-            return (uint32_t)((a+b)/2ULL);
-        } else if(lower.size()>upper.size()) {
-            return lower.top();
-        } else {
-            return upper.top();
-        }
-    }
-};
-
 // The function that merges wave-based logic with SFML 3 alpha
 int runSimulation(){
     // Read the 'header'
@@ -108,6 +77,7 @@ int runSimulation(){
         std::getline(std::cin, ignored); 
     }
     uint32_t bagCapacity, seed, maxDist, maxSpeed, maxHP;
+    KoopaRandomGenerator rng;
     {
         std::string dummy;
         std::cin >> dummy >> bagCapacity;
@@ -115,7 +85,7 @@ int runSimulation(){
         std::cin >> dummy >> maxDist;
         std::cin >> dummy >> maxSpeed;
         std::cin >> dummy >> maxHP;
-        KoopaRandomGenerator::initialize(seed, maxDist, maxSpeed, maxHP);
+        rng.initialize(seed, maxDist, maxSpeed, maxHP);
     }
 
     // read wave data
@@ -171,10 +141,10 @@ int runSimulation(){
     // spawnKoopas
     auto spawnKoopas = [&](uint32_t randomCount,const std::vector<std::string>& lines){
         for(uint32_t i=0;i<randomCount;i++){
-            auto nm=KoopaRandomGenerator::getNextKoopaName();
-            auto dist=KoopaRandomGenerator::getNextKoopaDistance();
-            auto sp=KoopaRandomGenerator::getNextKoopaSpeed();
-            auto hp=KoopaRandomGenerator::getNextKoopaHealth();
+            auto nm=rng.getNextKoopaName();
+            auto dist=rng.getNextKoopaDistance();
+            auto sp=rng.getNextKoopaSpeed();
+            auto hp=rng.getNextKoopaHealth();
             Koopa* k=new Koopa(nm, dist, sp, hp, currentRound, koopaCounter++);
             allKoopas.push_back(k);
             activeCount++;
@@ -0,0 +1,353 @@
+// koopa_regress.cpp   End-to-end timing and output check of the game binary.
+//
+//   koopa_regress [--record] [--update-golden] [--binary PATH]
+//                 [--cases FILE] [--golden FILE] [--baseline FILE]
+//                 [--corpus DIR] [--generator PATH] [--runs N]
+//                 [--time-slack PCT] [--rss-slack PCT]
+//
+// Each line of the cases file (default bench/regress_cases.txt) is
+//
+//   NAME  [exit=N]  GAME FLAGS ... -- SCENARIO_GEN OPTIONS ...
+//
+// A case fails if the game exits with any status other than N (default
+// 0); the run stops there, so no golden output is taken from an error.
+// The scenario of a case is written to the corpus directory by
+// scenario_gen the first time it is needed. Instead of generator options a
+// case can name an earlier case as `@CASE` and play its scenario, e.g. to
+// resume from the checkpoints that case wrote. The binary then plays it
+// `runs` times with stdout hashed, keeping the fastest wall time and the
+// largest peak RSS.
+//
+// The output of every case is checked against its size and FNV-1a hash in
+// the golden file (default bench/regress_golden.txt), which is checked in
+// since the game is deterministic; --update-golden rewrites it after an
+// intended change of output. Wall time and peak RSS depend on the machine,
+// so they are compared with a local baseline that --record writes, and
+// only flagged when more than the slack above it. Exits with 1 if anything
+// was flagged.
+
+#include <cerrno>
+#include <chrono>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <fcntl.h>
+#include <fstream>
+#include <getopt.h>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <sys/resource.h>
+#include <sys/stat.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include <vector>
+
+using namespace std;
+
+namespace {
+
+struct Case {
+    string name;
+    int exitStatus = 0;
+    vector<string> gameArgs;
+    vector<string> genArgs;
+};
+
+struct Result {
+    uint64_t outputBytes = 0;
+    uint64_t outputHash = 0;
+    double   wallMs = 0;
+    uint64_t peakRssKb = 0;
+    int      exitStatus = 0;
+};
+
+// NAME BYTES HASH
+bool readGolden(const string &path, map<string, Result> &golden) {
+    ifstream in(path);
+    if (!in) return false;
+    string name;
+    Result r;
+    while (in >> name >> r.outputBytes >> hex >> r.outputHash >> dec) {
+        golden[name] = r;
+    }
+    return true;
+}
+
+bool readCases(const string &path, vector<Case> &cases) {
+    ifstream in(path);
+    if (!in) return false;
+    string line;
+    while (getline(in, line)) {
+        istringstream words(line);
+        Case c;
+        if (!(words >> c.name) || c.name[0] == '#') continue;
+        string w;
+        bool gen = false;
+        if (words >> w && w.compare(0, 5, "exit=") == 0) {
+            c.exitStatus = atoi(w.c_str() + 5);
+        } else if (!w.empty()) {
+            c.gameArgs.push_back(w);
+        }
+        while (words >> w) {
+            if (w == "--" && !gen) {
+                gen = true;
+                continue;
+            }
+            (gen ? c.genArgs : c.gameArgs).push_back(w);
+        }
+        cases.push_back(std::move(c));
+    }
+    return true;
+}
+
+// NAME WALL_MS PEAK_RSS_KB
+bool readBaseline(const string &path, map<string, Result> &baseline) {
+    ifstream in(path);
+    if (!in) return false;
+    string name;
+    Result r;
+    while (in >> name >> r.wallMs >> r.peakRssKb) {
+        baseline[name] = r;
+    }
+    return true;
+}
+
+// Runs argv[0] with stdin from `input` and stdout to `outputFd` (or, if
+// that is negative, into a pipe whose bytes are counted and hashed).
+// Returns false if the program could not be run or did not exit normally;
+// otherwise its exit status is in r.exitStatus.
+bool run(const vector<string> &args, const string &input, int outputFd,
+         Result &r) {
+    int pipeFds[2] = { -1, -1 };
+    if (outputFd < 0 && pipe(pipeFds) != 0) return false;
+    int in = open(input.c_str(), O_RDONLY);
+    if (in < 0) {
+        cerr << "Cannot open " << input << "\n";
+        return false;
+    }
+    auto start = chrono::steady_clock::now();
+    pid_t pid = fork();
+    if (pid < 0) return false;
+    if (pid == 0) {
+        dup2(in, STDIN_FILENO);
+        dup2(outputFd >= 0 ? outputFd : pipeFds[1], STDOUT_FILENO);
+        vector<char*> argv;
+        for (const string &a : args) argv.push_back(const_cast<char*>(a.c_str()));
+        argv.push_back(nullptr);
+        execv(argv[0], argv.data());
+        _exit(127);
+    }
+    close(in);
+    r.outputBytes = 0;
+    r.outputHash = 14695981039346656037ULL;
+    if (outputFd < 0) {
+        close(pipeFds[1]);
+        static char buf[1 << 16];
+        ssize_t n;
+        while ((n = read(pipeFds[0], buf, sizeof buf)) != 0) {
+            if (n < 0) {
+                if (errno == EINTR) continue;
+                break;
+            }
+            for (ssize_t i = 0; i < n; i++) {
+                r.outputHash = (r.outputHash ^ static_cast<unsigned char>(buf[i]))
+                               * 1099511628211ULL;
+            }
+            r.outputBytes += static_cast<uint64_t>(n);
+        }
+        close(pipeFds[0]);
+    }
+    int status;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid) return false;
+    chrono::duration<double, milli> took = chrono::steady_clock::now() - start;
+    r.wallMs = took.count();
+    r.peakRssKb = static_cast<uint64_t>(usage.ru_maxrss);
+    if (!WIFEXITED(status) || WEXITSTATUS(status) == 127) return false;
+    r.exitStatus = WEXITSTATUS(status);
+    return true;
+}
+
+bool fileExists(const string &path) {
+    struct stat st;
+    return stat(path.c_str(), &st) == 0;
+}
+
+void usage() {
+    cerr << "Usage: koopa_regress [--record] [--update-golden]"
+         << " [--binary PATH] [--cases FILE] [--golden FILE]"
+         << " [--baseline FILE] [--corpus DIR] [--generator PATH]"
+         << " [--runs N] [--time-slack PCT] [--rss-slack PCT]\n";
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    bool record = false, updateGolden = false;
+    string binary = "./game";
+    string casesPath = "bench/regress_cases.txt";
+    string goldenPath = "bench/regress_golden.txt";
+    string baselinePath = "bench/regress_baseline.txt";
+    string corpus = "bench/corpus";
+    string generator = "tools/scenario_gen";
+    unsigned runs = 3;
+    double timeSlack = 20, rssSlack = 10;
+
+    static struct option longOpts[] = {
+        {"record",     no_argument,       nullptr, 'R'},
+        {"update-golden", no_argument,    nullptr, 'U'},
+        {"binary",     required_argument, nullptr, 'b'},
+        {"cases",      required_argument, nullptr, 'c'},
+        {"golden",     required_argument, nullptr, 'G'},
+        {"baseline",   required_argument, nullptr, 'B'},
+        {"corpus",     required_argument, nullptr, 'C'},
+        {"generator",  required_argument, nullptr, 'g'},
+        {"runs",       required_argument, nullptr, 'n'},
+        {"time-slack", required_argument, nullptr, 't'},
+        {"rss-slack",  required_argument, nullptr, 'm'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt, idx;
+    while ((opt = getopt_long(argc, argv, "RUb:c:G:B:C:g:n:t:m:", longOpts,
+                              &idx)) != -1) {
+        switch (opt) {
+            case 'R': record = true; break;
+            case 'U': updateGolden = true; break;
+            case 'b': binary = optarg; break;
+            case 'c': casesPath = optarg; break;
+            case 'G': goldenPath = optarg; break;
+            case 'B': baselinePath = optarg; break;
+            case 'C': corpus = optarg; break;
+            case 'g': generator = optarg; break;
+            case 'n':
+                runs = static_cast<unsigned>(strtoul(optarg, nullptr, 10));
+                if (runs == 0) runs = 1;
+                break;
+            case 't': timeSlack = strtod(optarg, nullptr); break;
+            case 'm': rssSlack = strtod(optarg, nullptr); break;
+            default: usage(); return 2;
+        }
+    }
+
+    vector<Case> cases;
+    if (!readCases(casesPath, cases)) {
+        cerr << "Cannot read cases file: " << casesPath << "\n";
+        return 2;
+    }
+    map<string, Result> golden, baseline;
+    if (!updateGolden && !readGolden(goldenPath, golden)) {
+        cerr << "Cannot read golden outputs: " << goldenPath << "\n";
+        return 2;
+    }
+    bool timed = !record && readBaseline(baselinePath, baseline);
+    mkdir(corpus.c_str(), 0755);
+
+    vector<pair<string, Result>> results;
+    bool flagged = false;
+    for (const Case &c : cases) {
+        bool shared = c.genArgs.size() == 1 && c.genArgs[0][0] == '@';
+        string scenario = corpus + "/" +
+                          (shared ? c.genArgs[0].substr(1) : c.name) + ".txt";
+        if (shared && !fileExists(scenario)) {
+            cerr << c.name << ": no scenario " << scenario << "\n";
+            return 2;
+        }
+        if (!fileExists(scenario)) {
+            vector<string> gen = c.genArgs;
+            gen.insert(gen.begin(), generator);
+            int fd = open(scenario.c_str(), O_WRONLY | O_CREAT | O_TRUNC, 0644);
+            Result ignored;
+            bool ok = fd >= 0 && run(gen, "/dev/null", fd, ignored) &&
+                      ignored.exitStatus == 0;
+            if (fd >= 0) close(fd);
+            if (!ok) {
+                unlink(scenario.c_str());
+                cerr << c.name << ": cannot generate " << scenario << "\n";
+                return 2;
+            }
+        }
+
+        Result best;
+        vector<string> args = c.gameArgs;
+        args.insert(args.begin(), binary);
+        for (unsigned i = 0; i < runs; i++) {
+            Result r;
+            if (!run(args, scenario, -1, r)) {
+                cerr << c.name << ": " << binary << " failed\n";
+                return 2;
+            }
+            if (r.exitStatus != c.exitStatus) {
+                cerr << c.name << ": " << binary << " exited with "
+                     << r.exitStatus << ", expected " << c.exitStatus << "\n";
+                return 2;
+            }
+            if (i == 0 || r.wallMs < best.wallMs) best.wallMs = r.wallMs;
+            if (r.peakRssKb > best.peakRssKb) best.peakRssKb = r.peakRssKb;
+            best.outputBytes = r.outputBytes;
+            best.outputHash = r.outputHash;
+        }
+        results.push_back({ c.name, best });
+
+        printf("%-24s %10.1f ms %9llu KB", c.name.c_str(), best.wallMs,
+               static_cast<unsigned long long>(best.peakRssKb));
+        auto it = baseline.find(c.name);
+        if (timed && it != baseline.end()) {
+            const Result &b = it->second;
+            printf("  %+6.1f%% time %+6.1f%% rss",
+                   100 * (best.wallMs / b.wallMs - 1),
+                   100 * (static_cast<double>(best.peakRssKb) /
+                          static_cast<double>(b.peakRssKb) - 1));
+            if (best.wallMs > b.wallMs * (1 + timeSlack / 100)) {
+                printf("  SLOWER");
+                flagged = true;
+            }
+            if (static_cast<double>(best.peakRssKb) >
+                static_cast<double>(b.peakRssKb) * (1 + rssSlack / 100)) {
+                printf("  MORE MEMORY");
+                flagged = true;
+            }
+        } else if (!record) {
+            printf("  (no timing baseline)");
+        }
+        if (!updateGolden) {
+            auto g = golden.find(c.name);
+            if (g == golden.end()) {
+                printf("  NO GOLDEN OUTPUT");
+                flagged = true;
+            } else if (best.outputBytes != g->second.outputBytes ||
+                       best.outputHash != g->second.outputHash) {
+                printf("  OUTPUT CHANGED");
+                flagged = true;
+            }
+        }
+        printf("\n");
+    }
+
+    if (updateGolden) {
+        ofstream out(goldenPath);
+        for (const auto &e : results) {
+            out << e.first << " " << e.second.outputBytes << " " << hex
+                << e.second.outputHash << dec << "\n";
+        }
+        if (!out) {
+            cerr << "Cannot write golden outputs: " << goldenPath << "\n";
+            return 2;
+        }
+        printf("Golden outputs written to %s\n", goldenPath.c_str());
+    }
+    if (record) {
+        ofstream out(baselinePath);
+        for (const auto &e : results) {
+            out << e.first << " " << e.second.wallMs << " "
+                << e.second.peakRssKb << "\n";
+        }
+        if (!out) {
+            cerr << "Cannot write baseline: " << baselinePath << "\n";
+            return 2;
+        }
+        printf("Baseline written to %s\n", baselinePath.c_str());
+    }
+    return flagged ? 1 : 0;
+}
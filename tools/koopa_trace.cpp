@@ -0,0 +1,225 @@
+// koopa_trace.cpp   Reads traces written by `game --trace FILE`.
+//
+//   koopa_trace expand TRACE      print the verbose text of the game
+//   koopa_trace diff A B          compare two games round by round
+//
+// diff exits with 1 when the traces differ and prints the first lines that
+// differ in each differing round. Lines are matched by Koopa name within
+// the round, not by position, so a changed order shows only the Koopas
+// whose lines changed. Both exit with 1 on a truncated or malformed
+// trace.
+
+#include <cstdint>
+#include <cstdlib>
+#include <deque>
+#include <fcntl.h>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <unistd.h>
+#include <unordered_map>
+#include <vector>
+#include "../KoopaTrace.h"
+#include "../OutputWriter.h"
+#include "../ScenarioParser.h"
+
+using namespace std;
+
+namespace {
+
+const size_t LINES_PER_ROUND = 8;
+const size_t ROUNDS_REPORTED = 20;
+
+int openTrace(const char *path) {
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) {
+        cerr << "Cannot open trace file: " << path << "\n";
+        exit(1);
+    }
+    return fd;
+}
+
+void splitLines(string_view text, vector<string_view> &lines) {
+    lines.clear();
+    while (!text.empty()) {
+        size_t nl = text.find('\n');
+        if (nl == string_view::npos) nl = text.size() - 1;
+        lines.push_back(text.substr(0, nl));
+        text.remove_prefix(nl + 1);
+    }
+}
+
+// True if the trace stopped other than at its end marker.
+bool stoppedEarly(TraceReader::Status status) {
+    return status == TraceReader::TRUNCATED || status == TraceReader::MALFORMED;
+}
+
+void reportStop(TraceReader::Status status, const TraceReader &reader,
+                const char *path) {
+    cerr << path << (status == TraceReader::TRUNCATED ? ": truncated"
+                                                      : ": malformed")
+         << " trace after round " << reader.round() << "\n";
+}
+
+const size_t NO_MATCH = SIZE_MAX;
+
+// What a line is about: "Moved: NAME" for a Koopa line, the whole line
+// for the others.
+string_view lineKey(string_view line) {
+    size_t paren = line.find(" (");
+    return paren == string_view::npos ? line : line.substr(0, paren);
+}
+
+// Pairs each line of `a` with the line of `b` about the same Koopa, so a
+// Koopa that changed places in the round is not reported as a change.
+// Repeated names pair up in order. matches[i] is the line of `b` for a[i]
+// or NO_MATCH; matchedB[j] is whether b[j] was paired.
+void matchLines(const vector<string_view> &a, const vector<string_view> &b,
+                vector<size_t> &matches, vector<bool> &matchedB) {
+    unordered_map<string_view, deque<size_t>> byKey;
+    for (size_t j = 0; j < b.size(); j++) byKey[lineKey(b[j])].push_back(j);
+    matches.assign(a.size(), NO_MATCH);
+    matchedB.assign(b.size(), false);
+    for (size_t i = 0; i < a.size(); i++) {
+        auto it = byKey.find(lineKey(a[i]));
+        if (it == byKey.end() || it->second.empty()) continue;
+        matches[i] = it->second.front();
+        matchedB[matches[i]] = true;
+        it->second.pop_front();
+    }
+}
+
+int expandTrace(const char *path) {
+    int fd = openTrace(path);
+    InputBuffer input(fd);
+    TraceReader reader(input.begin(), input.end());
+    if (!reader.valid()) {
+        cerr << path << ": not a Koopa trace\n";
+        return 1;
+    }
+    OutputWriter out;
+    TraceExpander expander;
+    TraceFrame frame;
+    string text;
+    TraceReader::Status status;
+    while ((status = reader.next(frame)) == TraceReader::FRAME) {
+        text.clear();
+        if (!expander.expand(frame, text)) {
+            out.flush();
+            cerr << path << ": malformed frame in round " << frame.round << "\n";
+            return 1;
+        }
+        out << text;
+    }
+    close(fd);
+    if (stoppedEarly(status)) {
+        out.flush();
+        reportStop(status, reader, path);
+        return 1;
+    }
+    return 0;
+}
+
+int diffTraces(const char *pathA, const char *pathB) {
+    int fdA = openTrace(pathA);
+    int fdB = openTrace(pathB);
+    InputBuffer inputA(fdA);
+    InputBuffer inputB(fdB);
+    TraceReader readerA(inputA.begin(), inputA.end());
+    TraceReader readerB(inputB.begin(), inputB.end());
+    if (!readerA.valid() || !readerB.valid()) {
+        cerr << (readerA.valid() ? pathB : pathA) << ": not a Koopa trace\n";
+        return 1;
+    }
+
+    OutputWriter out;
+    TraceExpander expanderA, expanderB;
+    TraceFrame frameA, frameB;
+    string textA, textB;
+    vector<string_view> linesA, linesB;
+    vector<size_t> matches;
+    vector<bool> matchedB;
+    size_t differing = 0;
+    while (true) {
+        TraceReader::Status statusA = readerA.next(frameA);
+        TraceReader::Status statusB = readerB.next(frameB);
+        if (stoppedEarly(statusA) || stoppedEarly(statusB)) {
+            out.flush();
+            if (stoppedEarly(statusA)) reportStop(statusA, readerA, pathA);
+            if (stoppedEarly(statusB)) reportStop(statusB, readerB, pathB);
+            return 1;
+        }
+        bool hasA = statusA == TraceReader::FRAME;
+        bool hasB = statusB == TraceReader::FRAME;
+        if (!hasA && !hasB) break;
+        if (hasA != hasB) {
+            const TraceFrame &extra = hasA ? frameA : frameB;
+            out << (hasA ? pathB : pathA) << " ends before round "
+                << extra.round << "\n";
+            differing++;
+            break;
+        }
+        textA.clear();
+        textB.clear();
+        bool okA = expanderA.expand(frameA, textA);
+        bool okB = expanderB.expand(frameB, textB);
+        if (!okA || !okB) {
+            out.flush();
+            cerr << (okA ? pathB : pathA) << ": malformed frame in round "
+                 << (okA ? frameB.round : frameA.round) << "\n";
+            return 1;
+        }
+        // Identical frames after identical history expand to the same text.
+        if (frameA.round == frameB.round && textA == textB &&
+            frameA.payload == frameB.payload) {
+            continue;
+        }
+        if (++differing > ROUNDS_REPORTED) continue;
+
+        out << "@@ round " << frameA.round;
+        if (frameB.round != frameA.round) out << " / " << frameB.round;
+        out << " @@\n";
+        splitLines(textA, linesA);
+        splitLines(textB, linesB);
+        matchLines(linesA, linesB, matches, matchedB);
+        size_t shown = 0;
+        for (size_t i = 0; i < linesA.size() && shown < LINES_PER_ROUND; i++) {
+            size_t j = matches[i];
+            if (j != NO_MATCH && linesA[i] == linesB[j]) continue;
+            out << "- " << linesA[i] << "\n";
+            if (j != NO_MATCH) out << "+ " << linesB[j] << "\n";
+            shown++;
+        }
+        for (size_t j = 0; j < linesB.size() && shown < LINES_PER_ROUND; j++) {
+            if (matchedB[j]) continue;
+            out << "+ " << linesB[j] << "\n";
+            shown++;
+        }
+        if (shown == LINES_PER_ROUND) out << "  ...\n";
+        if (shown == 0) out << "  (same text, different move summary)\n";
+    }
+    if (differing > ROUNDS_REPORTED) {
+        out << (differing - ROUNDS_REPORTED) << " more differing rounds\n";
+    }
+    close(fdA);
+    close(fdB);
+    return differing == 0 ? 0 : 1;
+}
+
+void usage() {
+    cerr << "Usage: koopa_trace expand TRACE\n"
+         << "       koopa_trace diff TRACE_A TRACE_B\n";
+}
+
+} // namespace
+
+int main(int argc, char *argv[]) {
+    if (argc == 3 && string(argv[1]) == "expand") {
+        return expandTrace(argv[2]);
+    }
+    if (argc == 4 && string(argv[1]) == "diff") {
+        return diffTraces(argv[2], argv[3]);
+    }
+    usage();
+    return 2;
+}
@@ -0,0 +1,176 @@
+// scenario_gen.cpp   Writes a synthetic scenario in the game's input format.
+//
+//   scenario_gen [options] [-o FILE]
+//
+//   --waves N          wave blocks (default 10)
+//   --gap A..B         rounds from one wave to the next, A >= 1
+//                      (default 1..3)
+//   --random A..B      random Koopas per wave (default 0..10)
+//   --no-random        no random Koopas, and every Max-Rand-* is 0
+//   --named A..B       named Koopas per wave (default 0..3)
+//   --names N          draw named Koopas' names from N names, so they
+//                      repeat (default 0: every name is different)
+//   --distance A..B    named Koopa distance; B is also Max-Rand-Distance
+//   --speed A..B       likewise for speed (default 1..10)
+//   --health A..B      likewise for health (default 1..10)
+//   --bag N            Bag-Capacity (default 10)
+//   --seed N           Seed of the game and of this generator (default 1)
+//
+// Output is streamed as it is generated, so memory stays constant however
+// big the scenario is. The same options always give the same file.
+
+#include <charconv>
+#include <cstdint>
+#include <cstdlib>
+#include <fcntl.h>
+#include <getopt.h>
+#include <iostream>
+#include <random>
+#include <string>
+#include <unistd.h>
+#include "../OutputWriter.h"
+
+using namespace std;
+
+namespace {
+
+struct Range {
+    uint64_t lo;
+    uint64_t hi;
+};
+
+// Parses "A..B" (or a single "A") with A <= B.
+bool parseRange(const char *spec, Range &r) {
+    string s(spec);
+    size_t dots = s.find("..");
+    string first = dots == string::npos ? s : s.substr(0, dots);
+    string last = dots == string::npos ? s : s.substr(dots + 2);
+    auto r1 = from_chars(first.data(), first.data() + first.size(), r.lo);
+    auto r2 = from_chars(last.data(), last.data() + last.size(), r.hi);
+    return !first.empty() && !last.empty() &&
+           r1.ec == errc() && r1.ptr == first.data() + first.size() &&
+           r2.ec == errc() && r2.ptr == last.data() + last.size() &&
+           r.lo <= r.hi;
+}
+
+// Uniform in [r.lo, r.hi]. Plain modulo rather than a std distribution,
+// whose output differs between standard libraries.
+uint64_t pick(mt19937_64 &g, const Range &r) {
+    uint64_t span = r.hi - r.lo + 1;
+    return span == 0 ? g() : r.lo + g() % span;
+}
+
+void usage() {
+    cerr << "Usage: scenario_gen [--waves N] [--gap A..B] [--random A..B]"
+         << " [--no-random] [--named A..B] [--names N] [--distance A..B] [--speed A..B]"
+         << " [--health A..B] [--bag N] [--seed N] [-o FILE]\n";
+}
+
+}
+
+int main(int argc, char *argv[]) {
+    uint64_t waves = 10, bag = 10, seed = 1, names = 0;
+    Range gap{1, 3}, random{0, 10}, named{0, 3};
+    Range distance{1, 1000}, speed{1, 10}, health{1, 10};
+    bool noRandom = false;
+    const char *path = nullptr;
+
+    static struct option longOpts[] = {
+        {"waves",    required_argument, nullptr, 'w'},
+        {"gap",      required_argument, nullptr, 'g'},
+        {"random",   required_argument, nullptr, 'r'},
+        {"no-random", no_argument,      nullptr, 'R'},
+        {"named",    required_argument, nullptr, 'n'},
+        {"names",    required_argument, nullptr, 'N'},
+        {"distance", required_argument, nullptr, 'd'},
+        {"speed",    required_argument, nullptr, 'v'},
+        {"health",   required_argument, nullptr, 'p'},
+        {"bag",      required_argument, nullptr, 'b'},
+        {"seed",     required_argument, nullptr, 's'},
+        {"output",   required_argument, nullptr, 'o'},
+        {nullptr, 0, nullptr, 0}
+    };
+    int opt, idx;
+    while ((opt = getopt_long(argc, argv, "w:g:r:Rn:N:d:v:p:b:s:o:", longOpts,
+                              &idx)) != -1) {
+        Range single;
+        bool ok = true;
+        switch (opt) {
+            case 'w': ok = parseRange(optarg, single); waves = single.lo; break;
+            case 'b': ok = parseRange(optarg, single); bag = single.lo; break;
+            case 's': ok = parseRange(optarg, single); seed = single.lo; break;
+            case 'N': ok = parseRange(optarg, single); names = single.lo; break;
+            case 'g': ok = parseRange(optarg, gap); break;
+            case 'r': ok = parseRange(optarg, random); break;
+            case 'R': noRandom = true; break;
+            case 'n': ok = parseRange(optarg, named); break;
+            case 'd': ok = parseRange(optarg, distance); break;
+            case 'v': ok = parseRange(optarg, speed); break;
+            case 'p': ok = parseRange(optarg, health); break;
+            case 'o': path = optarg; break;
+            default: usage(); return 2;
+        }
+        if (!ok) {
+            cerr << "Invalid number or range: " << optarg << "\n";
+            return 2;
+        }
+    }
+    if (speed.lo == 0) {
+        cerr << "Koopa speeds must be at least 1\n";
+        return 2;
+    }
+    if (gap.lo == 0) {
+        // Two blocks with the same wave number make the game loop forever.
+        cerr << "Wave gaps must be at least 1\n";
+        return 2;
+    }
+    if (noRandom) random = Range{0, 0};
+
+    int fd = STDOUT_FILENO;
+    if (path) {
+        fd = open(path, O_WRONLY | O_CREAT | O_TRUNC, 0644);
+        if (fd < 0) {
+            cerr << "Cannot open output file: " << path << "\n";
+            return 1;
+        }
+    }
+
+    static const char *bases[] = { "Bowser", "kamek", "Lakitu", "boo",
+                                   "Goomba", "koopaKid" };
+    static const char *suffixes[] = { "", "x", "Z" };
+    mt19937_64 g(seed);
+    {
+        OutputWriter out(fd);
+        out << "COMMENT: scenario_gen --seed " << seed << "\n"
+            << "Bag-Capacity: " << bag << "\n"
+            << "Seed: " << seed << "\n"
+            << "Max-Rand-Distance: " << (noRandom ? 0 : distance.hi) << "\n"
+            << "Max-Rand-Speed: " << (noRandom ? 0 : speed.hi) << "\n"
+            << "Max-Rand-Health: " << (noRandom ? 0 : health.hi) << "\n";
+        uint64_t wave = 0, id = 0;
+        for (uint64_t w = 0; w < waves; w++) {
+            wave += pick(g, gap);
+            uint64_t count = pick(g, named);
+            out << "---\n"
+                << "wave: " << wave << "\n"
+                << "random-koopas: " << pick(g, random) << "\n"
+                << "named-koopas: " << count << "\n";
+            for (uint64_t k = 0; k < count; k++) {
+                if (names > 0) {
+                    uint64_t n = g() % names;
+                    out << bases[n % 6] << n;
+                } else {
+                    out << bases[g() % 6] << ++id << suffixes[g() % 3];
+                }
+                out << " distance: " << pick(g, distance)
+                    << " speed: " << pick(g, speed)
+                    << " health: " << pick(g, health) << "\n";
+            }
+        }
+    }
+    if (path && close(fd) != 0) {
+        cerr << "Cannot write output file: " << path << "\n";
+        return 1;
+    }
+    return 0;
+}